@@ -12,12 +12,18 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "mm_bitmap.h"
+#include "mm_buddy.h"
+#include "mm_oob.h"
+#include "mm_region.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
@@ -47,7 +53,8 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC,
+	  REGION_ALLOC, REGION_RESET} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
@@ -61,6 +68,9 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int uses_region;     /* does the trace contain region requests? */
+    int *region_ids;     /* ids allocated in the region since its last reset */
+    unsigned num_region_ids; /* number of ids in region_ids */
 } trace_t;
 
 /* 
@@ -73,16 +83,53 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* The state of one thread replaying a trace for eval_mm_threads */
+typedef struct {
+    trace_t *trace;
+    char **blocks;   /* this thread's ptrs returned by malloc/realloc */
+    int failed;      /* 1 if an allocation failed, 2 if a block was
+			corrupted by another thread */
+} replay_t;
+
+/* Holds the params to eval_mm_threads_speed, which is timed by fcyc */
+typedef struct {
+    int nthreads;
+    replay_t *replays; /* one per thread */
+} threads_t;
+
+/* An allocator package with the same interface as mm.c */
+typedef struct {
+    char *name;                             /* name for -b and results */
+    int (*init)(void);                      /* ... and its mm_init, */
+    void *(*malloc)(size_t size);           /* mm_malloc, */
+    void (*free)(void *ptr);                /* mm_free, */
+    void *(*realloc)(void *ptr, size_t size); /* and mm_realloc */
+} package_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
+    int skipped;     /* was the trace left out, as region traces are by -b? */
     double secs;     /* number of secs needed to run the trace */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only when lifetime-segregated placement is on (-L) */
+    unsigned lt_blocks; /* blocks allocated and freed without a realloc */
+    unsigned lt_tp;     /* ... placed short-lived that were short-lived */
+    unsigned lt_fp;     /* ... placed short-lived that were long-lived */
+    unsigned lt_fn;     /* ... placed long-lived that were short-lived */
+
+    /* defined only when the allocator counts requests (-s) */
+    struct mm_stats alloc; /* allocator statistics after the util run */
+
+    /* defined only when the heap overhead is broken down (-O) */
+    struct mm_overhead overhead; /* breakdown at the peak of the payload */
+    size_t heap_size;  /* heap size at the end of the util run */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -101,6 +148,20 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The student's package and the alternative engines selectable by -b */
+static package_t mm_package = {
+    "mm", mm_init, mm_malloc, mm_free, mm_realloc
+};
+static package_t backends[] = {
+    {"buddy", buddy_init, buddy_malloc, buddy_free, buddy_realloc},
+    {"bitmap", bitmap_init, bitmap_malloc, bitmap_free, bitmap_realloc},
+    {"oob", oob_init, oob_malloc, oob_free, oob_realloc},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+/* The package that the eval_mm_xxx routines evaluate */
+static package_t *pkg = &mm_package;
+
 
 /********************* 
  * Function prototypes 
@@ -121,13 +182,30 @@ static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
+   of the student's malloc package in mm.c, or of the package "pkg" */
+static void eval_package(package_t *package, char **tracefiles,
+			 int num_tracefiles, stats_t *stats, range_t **ranges,
+			 int lifetime, int counting, int overhead, int snap_ops,
+			 char *pproffile, char *foldedfile);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_lifetime(trace_t *trace, stats_t *stats);
+static void eval_mm_overhead(trace_t *trace, stats_t *stats);
+static void eval_mm_snapshots(trace_t *trace, char *tracefile, int snap_ops);
+static void eval_mm_profile(trace_t *trace, char *suffix, char *pproffile,
+			    char *foldedfile);
+static void eval_mm_threads(char **tracefiles, int num_tracefiles,
+			    int nthreads);
+static void eval_mm_threads_speed(void *ptr);
+static void *replay_trace(void *ptr);
+static long peak_payload(trace_t *trace);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlifetime(int n, stats_t *stats);
+static void printalloc(int n, stats_t *stats);
+static void printoverhead(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -146,10 +224,29 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *backend_stats = NULL; /* stats of the -b package, if any */
+    package_t *backend = NULL; /* package to evaluate next to mm (-b) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int lifetime = 0;    /* If set, segregate by lifetime (set by -L) */
+    int nursery = 0;     /* If set, use the small-object nursery (-N) */
+    int fit_index = 0;   /* If set, search a dense fit index (-D) */
+    int spans = 0;       /* If set, serve medium requests from spans (-S) */
+    int hugepages = 0;   /* If set, lay out the heap by hugepages (-H) */
+    int maint_us = 0;    /* If set, run the maintenance thread (-M) */
+    int cpucache = 0;    /* If set, use per-CPU caches (-C) */
+    int nthreads = 0;    /* If set, also replay in this many threads (-T) */
+    int counting = 0;    /* If set, count allocator statistics (-s) */
+    int overhead = 0;    /* If set, break down the heap overhead (-O) */
+    char *statsfile = NULL; /* If set, publish statistics there (-P) */
+    char *tracefile = NULL; /* If set, dump the event rings there (-E) */
+    char *pproffile = NULL; /* If set, dump a pprof heap profile there (-p) */
+    char *foldedfile = NULL; /* If set, dump folded stacks there (-F) */
+    int snap_ops = 0;    /* If set, snapshot the heap this often (-A) */
+    struct mm_maint_stats maint_stats;
+    struct mm_cpucache_stats cpucache_stats;
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
 
     /* temporaries used to compute the performance index */
@@ -159,11 +256,35 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "A:b:E:f:F:p:t:M:P:T:hvVgaCDHlLNOSs")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
+	case 'A': /* Snapshot the heap every <n> ops for mmmap */
+	    if ((snap_ops = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'b': /* Evaluate another engine next to mm */
+	    for (backend = backends; backend->name != NULL; backend++)
+		if (!strcmp(backend->name, optarg))
+		    break;
+	    if (backend->name == NULL) {
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 'E': /* Dump the allocator's event rings to <file> */
+            tracefile = optarg;
+            break;
+        case 'F': /* Dump the sampled heap profile as folded stacks */
+            foldedfile = optarg;
+            break;
+        case 'p': /* Dump the sampled heap profile for pprof */
+            pproffile = optarg;
+            break;
         case 'f': /* Use one specific trace file only (relative to curr dir) */
             num_tracefiles = 1;
             if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
@@ -182,9 +303,48 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'C': /* Cache small free blocks per CPU */
+            cpucache = 1;
+            break;
+        case 'D': /* Search free blocks through a dense fit index */
+            fit_index = 1;
+            break;
+        case 'H': /* Lay out the heap by hugepages */
+            hugepages = 1;
+            break;
+        case 'M': /* Run the maintenance thread every <usecs> */
+            if ((maint_us = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Publish allocator statistics in <file> for mmstat */
+            statsfile = optarg;
+            break;
+        case 'T': /* Replay each trace in <n> threads at once as well */
+            if ((nthreads = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Turn on lifetime-segregated placement */
+            lifetime = 1;
+            break;
+        case 'N': /* Turn on the nursery for small requests */
+            nursery = 1;
+            break;
+        case 'O': /* Break down the heap overhead at peak payload */
+            overhead = 1;
+            break;
+        case 'S': /* Serve medium requests from page spans */
+            spans = 1;
+            break;
+        case 's': /* Count allocator statistics and print them */
+            counting = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -287,32 +447,96 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    mm_lifetime_enable(lifetime);
+    mm_nursery_enable(nursery);
+    mm_fit_index_enable(fit_index);
+    mm_span_enable(spans);
+    mm_hugepage_enable(hugepages);
+    mm_cpucache_enable(cpucache);
+    mm_stats_enable(counting);
+    if (statsfile != NULL && mm_stats_publish(statsfile) < 0)
+	unix_error("mm_stats_publish failed");
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    if (maint_us > 0 && mm_maint_start(maint_us) < 0)
+	app_error("mm_maint_start failed");
+    eval_package(&mm_package, tracefiles, num_tracefiles, mm_stats, &ranges,
+		 lifetime, counting, overhead, snap_ops, pproffile, foldedfile);
+    mm_maint_stats(&maint_stats);
+    mm_maint_stop();
+    if (tracefile != NULL && mm_trace_dump(tracefile) < 0)
+	unix_error("mm_trace_dump failed (build with make TRACE=1)");
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	if (lifetime) {
+	    printf("Lifetime predictor (short-lived is under %d ops):\n",
+		   MM_SHORT_LIFETIME);
+	    printlifetime(num_tracefiles, mm_stats);
+	    printf("\n");
+	}
+	if (maint_us > 0) {
+	    printf("Maintenance thread (every %d us): %lu wakeups, "
+		   "%lu deferred frees coalesced (%lu by mm_malloc),\n"
+		   "%lu KB purged, %lu KB trimmed\n\n", maint_us,
+		   maint_stats.wakeups, maint_stats.frees + maint_stats.drained,
+		   maint_stats.drained, (unsigned long)maint_stats.purged / 1024,
+		   (unsigned long)maint_stats.trimmed / 1024);
+	}
+    }
+    if (counting) {
+	printf("Allocator statistics after each utilization run:\n");
+	printalloc(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (overhead) {
+	printf("Heap overhead at peak payload, in percent of the final heap:\n");
+	printoverhead(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally evaluate another engine on the same traces, and always
+     * display its results next to the mm results
+     */
+    if (backend != NULL) {
+	if (verbose > 1)
+	    printf("\nTesting %s malloc\n", backend->name);
+	backend_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (backend_stats == NULL)
+	    unix_error("backend_stats calloc in main failed");
+	eval_package(backend, tracefiles, num_tracefiles, backend_stats,
+		     &ranges, 0, 0, 0, 0, NULL, NULL);
+	printf("\nResults for %s malloc:\n", backend->name);
+	printresults(num_tracefiles, backend_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay the traces in several threads sharing the heap,
+     * with the maintenance thread scavenging the per-CPU caches
+     */
+    if (nthreads > 0) {
+	mm_threads_enable(1);
+	if (maint_us > 0 && mm_maint_start(maint_us) < 0)
+	    app_error("mm_maint_start failed");
+	eval_mm_threads(tracefiles, num_tracefiles, nthreads);
+	mm_cpucache_stats(&cpucache_stats);
+	mm_maint_stop();
+	mm_threads_enable(0);
+	if (verbose && cpucache) {
+	    printf("Per-CPU caches: %lu KB held, %lu KB capacity "
+		   "(limit %lu KB),\n%lu grown, %lu shrunk, "
+		   "%lu KB scavenged\n\n",
+		   (unsigned long)cpucache_stats.held / 1024,
+		   (unsigned long)cpucache_stats.capacity / 1024,
+		   (unsigned long)cpucache_stats.limit / 1024,
+		   cpucache_stats.grown, cpucache_stats.shrunk,
+		   (unsigned long)cpucache_stats.scavenged / 1024);
+	}
     }
 
     /* 
@@ -396,9 +620,8 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of one heap region */
+    if (!mem_in_heap(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -473,6 +696,13 @@ static void clear_ranges(range_t **ranges)
 
 /*
  * read_trace - read a trace file and store it in memory
+ *
+ * After the header, each line is one request:
+ *   a <id> <size>   mm_malloc
+ *   r <id> <size>   mm_realloc
+ *   f <id>          mm_free
+ *   n <id> <size>   mm_region_alloc from the trace's region
+ *   x               mm_region_reset of the trace's region
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -517,6 +747,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and the ids that are currently allocated in the region */
+    if ((trace->region_ids = 
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    trace->uses_region = 0;
     
     /* read every request line in the trace file */
     index = 0;
@@ -542,6 +778,20 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'n':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REGION_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    trace->uses_region = 1;
+	    break;
+	case 'x':
+	    trace->ops[op_index].type = REGION_RESET;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = 0;
+	    trace->uses_region = 1;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -558,14 +808,15 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * free_trace - Free the trace record and the four arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the four arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->region_ids);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -574,6 +825,68 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_package - Evaluate "package" on every tracefile, filling in one
+ *     stats_t struct per tracefile
+ */
+static void eval_package(package_t *package, char **tracefiles,
+			 int num_tracefiles, stats_t *stats, range_t **ranges,
+			 int lifetime, int counting, int overhead, int snap_ops,
+			 char *pproffile, char *foldedfile)
+{
+    int i;
+    trace_t *trace;
+    speed_t speed_params;
+    char suffix[16];
+
+    pkg = package;
+    for (i=0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+
+	/* Regions are built on mm_malloc, so only mm can run region traces */
+	if (trace->uses_region && pkg != &mm_package) {
+	    if (verbose > 1)
+		printf("Skipping region trace for %s_malloc.\n", pkg->name);
+	    stats[i].skipped = 1;
+	    free_trace(trace);
+	    continue;
+	}
+	if (verbose > 1)
+	    printf("Checking %s_malloc for correctness, ", pkg->name);
+	stats[i].valid = eval_mm_valid(trace, i, ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    stats[i].util = eval_mm_util(trace, i, ranges);
+	    if (counting)
+		mm_stats(&stats[i].alloc);
+	    if (overhead) {
+		stats[i].heap_size = mem_total_heapsize();
+		eval_mm_overhead(trace, &stats[i]);
+	    }
+	    if (snap_ops > 0)
+		eval_mm_snapshots(trace, tracefiles[i], snap_ops);
+	    if (pproffile != NULL || foldedfile != NULL) {
+		if (num_tracefiles > 1)
+		    snprintf(suffix, sizeof(suffix), ".%d", i);
+		else
+		    suffix[0] = '\0';
+		eval_mm_profile(trace, suffix, pproffile, foldedfile);
+	    }
+	    speed_params.trace = trace;
+	    speed_params.ranges = *ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (lifetime)
+		eval_mm_lifetime(trace, &stats[i]);
+	}
+	free_trace(trace);
+    }
+    pkg = &mm_package;
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -586,16 +899,22 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    mm_region_t *region = NULL;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
+    trace->num_region_ids = 0;
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (pkg->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL) {
+	malloc_error(tracenum, 0, "mm_region_create failed.");
+	return 0;
+    }
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -607,7 +926,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = pkg->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -636,7 +955,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = pkg->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -674,7 +993,33 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    pkg->free(p);
+	    break;
+
+        case REGION_ALLOC: /* mm_region_alloc */
+
+	    /* Allocate from the region and check the block like malloc's */
+	    if ((p = mm_region_alloc(region, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_region_alloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    trace->region_ids[trace->num_region_ids++] = index;
+	    break;
+
+        case REGION_RESET: /* mm_region_reset */
+
+	    /* Remove every region block from the list and reset the region */
+	    for (j = 0; j < trace->num_region_ids; j++)
+		remove_range(ranges, trace->blocks[trace->region_ids[j]]);
+	    trace->num_region_ids = 0;
+	    mm_region_reset(region);
 	    break;
 
 	default:
@@ -695,18 +1040,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   size of the heap in bytes after running the student's malloc 
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   is always the high water mark of the heap.  If the package spreads
+ *   its blocks over several memlib regions, heapsize is their sum.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    unsigned i;
+    unsigned i, j;
     int index;
     unsigned size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    mm_region_t *region = NULL;
 
     /* Remove the unused variable warnings */
     tracenum = tracenum;
@@ -714,8 +1061,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    trace->num_region_ids = 0;
+    if (pkg->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL)
+	app_error("mm_region_create failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -724,7 +1074,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = pkg->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -746,7 +1096,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = pkg->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -767,7 +1117,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    pkg->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -775,13 +1125,44 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case REGION_ALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_region_alloc(region, size)) == NULL) 
+		app_error("mm_region_alloc failed in eval_mm_util");
+
+	    /* Remember region and size */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    trace->region_ids[trace->num_region_ids++] = index;
+
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    total_size += size;
+
+	    /* Update statistics */
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case REGION_RESET: /* mm_region_reset */
+	    mm_region_reset(region);
+
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    for (j = 0; j < trace->num_region_ids; j++)
+		total_size -= trace->block_sizes[trace->region_ids[j]];
+	    trace->num_region_ids = 0;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_total_heapsize());
 }
 
 
@@ -794,11 +1175,14 @@ static void eval_mm_speed(void *ptr)
     unsigned i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    mm_region_t *region = NULL;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (pkg->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL)
+	app_error("mm_region_create failed in eval_mm_speed");
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -807,7 +1191,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = pkg->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -816,7 +1200,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = pkg->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -824,14 +1208,497 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            pkg->free(block);
+            break;
+
+	case REGION_ALLOC: /* mm_region_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_region_alloc(region, size)) == NULL)
+		app_error("mm_region_alloc error in eval_mm_speed");
+            trace->blocks[index] = p;
             break;
 
+	case REGION_RESET: /* mm_region_reset */
+	    mm_region_reset(region);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * eval_mm_threads - Replay every trace in nthreads threads at once, each
+ *    thread with its own block ids, and print the combined throughput.
+ *    The threads share the default heap, so there may be more of them
+ *    than CPUs.  Region traces are skipped, and so are traces whose
+ *    payload at its peak, times nthreads, exceeds the heap.  A trace in
+ *    which any timed replay runs out of memory, or in which a thread finds
+ *    one of its blocks overwritten, is reported as failed.
+ */
+static void eval_mm_threads(char **tracefiles, int num_tracefiles,
+			    int nthreads)
+{
+    int i, j, failed;
+    double secs, ops, total_secs = 0, total_ops = 0;
+    trace_t *trace;
+    threads_t params;
+
+    params.nthreads = nthreads;
+    if ((params.replays = (replay_t *)calloc(nthreads,
+					     sizeof(replay_t))) == NULL)
+	unix_error("calloc failed in eval_mm_threads");
+
+    printf("\nResults for mm malloc in %d threads:\n", nthreads);
+    printf("%5s%10s%10s %6s\n", "trace", "ops", "secs", "Kops");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	if (trace->uses_region) {
+	    printf("%2d%13s%10s %6s\n", i, "-", "-", "-");
+	    free_trace(trace);
+	    continue;
+	}
+	if (peak_payload(trace) * nthreads > MAX_HEAP) {
+	    printf("%2d%13s%10s %6s  (%s)\n", i, "-", "-", "-",
+		   "larger than the heap");
+	    free_trace(trace);
+	    continue;
+	}
+
+	/* Every timed replay must succeed, so failures accumulate */
+	for (j = 0; j < nthreads; j++) {
+	    params.replays[j].trace = trace;
+	    params.replays[j].failed = 0;
+	    if ((params.replays[j].blocks = (char **)calloc(trace->num_ids,
+		sizeof(char *))) == NULL)
+		unix_error("calloc failed in eval_mm_threads");
+	}
+	secs = fsecs(eval_mm_threads_speed, &params);
+	ops = (double)trace->num_ops * nthreads;
+	failed = 0;
+	for (j = 0; j < nthreads; j++) {
+	    failed |= params.replays[j].failed;
+	    free(params.replays[j].blocks);
+	}
+	if (failed)
+	    printf("%2d%13s%10s %6s  (%s)\n", i, "-", "-", "-",
+		   (failed & 2) ? "corrupted block" : "out of memory");
+	else {
+	    printf("%2d%13.0f%10.6f %6.0f\n", i, ops, secs,
+		   (ops/1e3)/secs);
+	    total_secs += secs;
+	    total_ops += ops;
+	}
+	free_trace(trace);
+    }
+    if (total_secs > 0)
+	printf("%-5s%10.0f%10.6f %6.0f\n", "Total", total_ops, total_secs,
+	       (total_ops/1e3)/total_secs);
+    free(params.replays);
+}
+
+/*
+ * eval_mm_threads_speed - Reset the heap and replay a trace in every
+ *    thread of a threads_t at once.  Timed by fcyc.
+ */
+static void eval_mm_threads_speed(void *ptr)
+{
+    threads_t *params = (threads_t *)ptr;
+    pthread_t *tids;
+    int i;
+
+    if ((tids = (pthread_t *)malloc(params->nthreads *
+				    sizeof(pthread_t))) == NULL)
+	unix_error("malloc failed in eval_mm_threads_speed");
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_threads_speed");
+    for (i = 0; i < params->nthreads; i++)
+	if (pthread_create(&tids[i], NULL, replay_trace,
+			   &params->replays[i]) != 0)
+	    app_error("pthread_create failed in eval_mm_threads_speed");
+    for (i = 0; i < params->nthreads; i++)
+	pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+/*
+ * replay_trace - The body of a thread of eval_mm_threads: replay the
+ *    malloc, realloc and free requests of a trace, and stop at the first
+ *    one that fails, recording why in replay->failed.  Each block is
+ *    tagged with its id in its first byte, which must survive until the
+ *    block is freed.
+ */
+static void *replay_trace(void *ptr)
+{
+    replay_t *replay = (replay_t *)ptr;
+    trace_t *trace = replay->trace;
+    char **blocks = replay->blocks;
+    unsigned i;
+    int index;
+    char *p;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL) {
+		replay->failed |= 1;
+		return NULL;
+	    }
+	    *p = (char)index;
+	    blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(blocks[index], trace->ops[i].size)) == NULL) {
+		replay->failed |= 1;
+		return NULL;
+	    }
+	    blocks[index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    if (*blocks[index] != (char)index) {
+		replay->failed |= 2;
+		return NULL;
+	    }
+	    mm_free(blocks[index]);
+	    blocks[index] = NULL;
+	    break;
+
+	default:
+	    break;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * peak_payload - Return the largest total payload that the malloc,
+ *    realloc and free requests of a trace hold at once.
+ */
+static long peak_payload(trace_t *trace)
+{
+    unsigned i;
+    int index;
+    long total_size = 0, max_total_size = 0;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    total_size += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size -
+		(long)trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	default:
+	    break;
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+    return max_total_size;
+}
+
+/*
+ * eval_mm_lifetime - Evaluate the accuracy of the lifetime predictor.
+ *   Each block that is allocated and later freed without being
+ *   reallocated is scored by comparing the heap that mm_malloc placed it
+ *   in with the number of trace operations that it actually lived.
+ */
+static void eval_mm_lifetime(trace_t *trace, stats_t *stats)
+{
+    unsigned i;
+    int index;
+    int *birth;       /* op that allocated each id, or -1 if unscored */
+    char *predicted;  /* was each id placed in the short-lived heap? */
+    char *p;
+    int actual;
+
+    if ((birth = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(predicted = (char *)malloc(trace->num_ids)) == NULL)
+	unix_error("malloc failed in eval_mm_lifetime");
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_lifetime");
+
+    stats->lt_blocks = stats->lt_tp = stats->lt_fp = stats->lt_fn = 0;
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in eval_mm_lifetime");
+            trace->blocks[index] = p;
+	    birth[index] = i;
+	    predicted[index] = mm_lifetime_predicted_short(p);
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index],
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_lifetime");
+            trace->blocks[index] = p;
+	    birth[index] = -1;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+	    if (birth[index] < 0)
+		break;
+	    actual = (i - birth[index]) < MM_SHORT_LIFETIME;
+	    stats->lt_blocks++;
+	    if (predicted[index] && actual)
+		stats->lt_tp++;
+	    else if (predicted[index])
+		stats->lt_fp++;
+	    else if (actual)
+		stats->lt_fn++;
+            break;
+
+	default: /* region blocks are not placed by lifetime */
+	    break;
+        }
+    }
+
+    free(birth);
+    free(predicted);
+}
+
+/*
+ * eval_mm_overhead - Break down the heap at the op where the total
+ *   payload peaks, which is the numerator of the utilization, and
+ *   compare it with the heap at the end of the trace, its denominator.
+ *   The chunks of the region count as blocks that mdriver does not hold.
+ */
+static void eval_mm_overhead(trace_t *trace, stats_t *stats)
+{
+    unsigned i, j, n, peak = 0;
+    int index;
+    long total_size = 0, max_total_size = 0;
+    char *live;       /* is each id held by a mm_malloc block? */
+    void **ptrs;      /* the held blocks at the peak ... */
+    size_t *sizes;    /* ... and their payload sizes */
+    mm_region_t *region = NULL;
+
+    if ((live = (char *)calloc(trace->num_ids, 1)) == NULL ||
+	(ptrs = (void **)malloc(trace->num_ids * sizeof(void *))) == NULL ||
+	(sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in eval_mm_overhead");
+
+    /* Find the op after which the total payload peaks */
+    trace->num_region_ids = 0;
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	case REGION_ALLOC:
+	    total_size += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    if (trace->ops[i].type == REGION_ALLOC)
+		trace->region_ids[trace->num_region_ids++] = index;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size -
+		(long)trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	case REGION_RESET:
+	    for (j = 0; j < trace->num_region_ids; j++)
+		total_size -= trace->block_sizes[trace->region_ids[j]];
+	    trace->num_region_ids = 0;
+	    break;
+	}
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    peak = i;
+	}
+    }
+
+    /* Replay the trace up to that op */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_overhead");
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL)
+	app_error("mm_region_create failed in eval_mm_overhead");
+    for (i = 0;  i < trace->num_ops && i <= peak;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    if ((trace->blocks[index] = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_overhead");
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    live[index] = 1;
+	    break;
+	case REALLOC:
+	    if ((trace->blocks[index] = mm_realloc(trace->blocks[index],
+						   trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_overhead");
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    live[index] = 0;
+	    break;
+	case REGION_ALLOC:
+	    if (mm_region_alloc(region, trace->ops[i].size) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_overhead");
+	    break;
+	case REGION_RESET:
+	    mm_region_reset(region);
+	    break;
+	}
+    }
+
+    /* Break down the heap around the blocks held at the peak */
+    for (index = 0, n = 0; index < (int)trace->num_ids; index++) {
+	if (live[index]) {
+	    ptrs[n] = trace->blocks[index];
+	    sizes[n++] = trace->block_sizes[index];
+	}
+    }
+    mm_overhead(&stats->overhead, ptrs, sizes, n);
+
+    free(live);
+    free(ptrs);
+    free(sizes);
+}
+
+/*
+ * eval_mm_snapshots - Replay the trace and write a snapshot of the heap
+ *   every "snap_ops" ops, and after the last, to <trace>.<n>.snap in the
+ *   current directory, where <trace> is the trace's file name without
+ *   ".rep" and <n> counts the snapshots from 0.
+ */
+static void eval_mm_snapshots(trace_t *trace, char *tracefile, int snap_ops)
+{
+    unsigned i, k = 0;
+    int index, fd;
+    char *name, path[MAXLINE];
+    size_t len;
+    mm_region_t *region = NULL;
+
+    if ((name = strrchr(tracefile, '/')) != NULL)
+	name++;
+    else
+	name = tracefile;
+    len = strlen(name);
+    if (len > 4 && strcmp(name + len - 4, ".rep") == 0)
+	len -= 4;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_snapshots");
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL)
+	app_error("mm_region_create failed in eval_mm_snapshots");
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    if ((trace->blocks[index] = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_snapshots");
+	    break;
+	case REALLOC:
+	    if ((trace->blocks[index] = mm_realloc(trace->blocks[index],
+						   trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_snapshots");
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	case REGION_ALLOC:
+	    if (mm_region_alloc(region, trace->ops[i].size) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_snapshots");
+	    break;
+	case REGION_RESET:
+	    mm_region_reset(region);
+	    break;
+	}
+	if ((i + 1) % snap_ops != 0 && i + 1 != trace->num_ops)
+	    continue;
+	snprintf(path, sizeof(path), "%.*s.%05u.snap", (int)len, name, k++);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+	    mm_heap_snapshot(fd) < 0 || close(fd) < 0)
+	    unix_error("mm_heap_snapshot failed in eval_mm_snapshots");
+    }
+}
+
+/*
+ * eval_mm_profile - Replay the trace with heap profiling on, and dump the
+ *   samples to <pproffile><suffix> for pprof and to <foldedfile><suffix>
+ *   as folded stacks, if those are not NULL.  Sampling is off during the
+ *   other runs, so the timed ones do not pay for it.
+ */
+static void eval_mm_profile(trace_t *trace, char *suffix, char *pproffile,
+			    char *foldedfile)
+{
+    unsigned i;
+    int index;
+    char path[MAXLINE];
+    mm_region_t *region = NULL;
+
+    /* Reset the heap, which forgets the samples of the last replay */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_profile");
+    if (trace->uses_region && (region = mm_region_create(0)) == NULL)
+	app_error("mm_region_create failed in eval_mm_profile");
+    mm_profile_enable(MM_PROFILE_INTERVAL);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    if ((trace->blocks[index] = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_profile");
+	    break;
+	case REALLOC:
+	    if ((trace->blocks[index] = mm_realloc(trace->blocks[index],
+						   trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_profile");
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	case REGION_ALLOC:
+	    if (mm_region_alloc(region, trace->ops[i].size) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_profile");
+	    break;
+	case REGION_RESET:
+	    mm_region_reset(region);
+	    break;
+	}
+    }
+    mm_profile_enable(0);
+
+    if (pproffile != NULL) {
+	snprintf(path, sizeof(path), "%s%s", pproffile, suffix);
+	if (mm_profile_dump(path, MM_PROFILE_PPROF) < 0)
+	    unix_error("mm_profile_dump failed in eval_mm_profile");
+    }
+    if (foldedfile != NULL) {
+	snprintf(path, sizeof(path), "%s%s", foldedfile, suffix);
+	if (mm_profile_dump(path, MM_PROFILE_FOLDED) < 0)
+	    unix_error("mm_profile_dump failed in eval_mm_profile");
+    }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -840,9 +1707,10 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    unsigned i, newsize;
+    unsigned i, j, newsize;
     char *p, *newp, *oldp;
 
+    trace->num_region_ids = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
@@ -868,6 +1736,21 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case REGION_ALLOC: /* libc has no regions, so malloc each block */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    trace->region_ids[trace->num_region_ids++] = trace->ops[i].index;
+	    break;
+
+	case REGION_RESET: /* ... and free each block on a reset */
+	    for (j = 0; j < trace->num_region_ids; j++)
+		free(trace->blocks[trace->region_ids[j]]);
+	    trace->num_region_ids = 0;
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -883,11 +1766,12 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    unsigned i;
+    unsigned i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
+    trace->num_region_ids = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
@@ -913,6 +1797,21 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+	case REGION_ALLOC: /* malloc standing in for a region */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    trace->region_ids[trace->num_region_ids++] = index;
+	    break;
+
+	case REGION_RESET: /* free standing in for a region reset */
+	    for (j = 0; j < trace->num_region_ids; j++)
+		free(trace->blocks[trace->region_ids[j]]);
+	    trace->num_region_ids = 0;
+	    break;
 	}
     }
 }
@@ -928,6 +1827,7 @@ static void eval_libc_speed(void *ptr)
 static void printresults(int n, stats_t *stats) 
 {
     int i;
+    int counted = 0;
     double secs = 0;
     double ops = 0;
     double util = 0;
@@ -938,6 +1838,11 @@ static void printresults(int n, stats_t *stats)
     printf("%5s%7s %5s%8s%10s %6s\n", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
     for (i=0; i < n; i++) {
+	if (stats[i].skipped) {
+	    printf("%2d%10s%6s%8s%10s %6s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	counted++;
 	if (stats[i].valid) {
 	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
 		   i,
@@ -961,11 +1866,11 @@ static void printresults(int n, stats_t *stats)
 	}
     }
 
-    /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
+    /* Print the aggregate results for the traces that were not skipped */
+    if (errors == 0 && counted > 0) {
 	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
 	       "Total       ",
-	       (util/n)*100.0,
+	       (util/counted)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
@@ -981,6 +1886,107 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlifetime - prints the accuracy of the lifetime predictor
+ */
+static void printlifetime(int n, stats_t *stats)
+{
+    int i;
+    unsigned correct;
+
+    printf("%5s%9s%9s%8s%9s%8s\n",
+	   "trace", "blocks", "correct", "short", "falsepos", "missed");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].lt_blocks == 0) {
+	    printf("%2d%12s%9s%8s%9s%8s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	correct = stats[i].lt_blocks - stats[i].lt_fp - stats[i].lt_fn;
+	printf("%2d%12u%8.1f%%%8u%9u%8u\n",
+	       i,
+	       stats[i].lt_blocks,
+	       100.0 * correct / stats[i].lt_blocks,
+	       stats[i].lt_tp + stats[i].lt_fn,
+	       stats[i].lt_fp,
+	       stats[i].lt_fn);
+    }
+}
+
+/*
+ * printalloc - Print the allocator statistics of each trace
+ */
+static void printalloc(int n, stats_t *stats)
+{
+    int i, c;
+    unsigned long nfree;
+
+    printf("%5s%9s%9s%9s%8s%7s%6s%9s%9s%8s%9s\n",
+	   "trace", "mallocs", "frees", "reallocs", "inplace", "copies",
+	   "sbrks", "heap KB", "free KB", "blocks", "largest");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%9s%9s%8s%7s%6s%9s%9s%8s%9s\n", i, "-", "-", "-",
+		   "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	nfree = 0;
+	for (c = 0; c < MM_STATS_CLASSES; c++)
+	    nfree += stats[i].alloc.free_blocks[c];
+	printf("%2d%12lu%9lu%9lu%8lu%7lu%6lu%9lu%9lu%8lu%9lu\n",
+	       i,
+	       stats[i].alloc.mallocs,
+	       stats[i].alloc.frees,
+	       stats[i].alloc.reallocs,
+	       stats[i].alloc.inplace,
+	       stats[i].alloc.copies,
+	       stats[i].alloc.sbrks,
+	       (unsigned long)stats[i].alloc.heap_size / 1024,
+	       (unsigned long)stats[i].alloc.free / 1024,
+	       nfree,
+	       (unsigned long)stats[i].alloc.largest_free);
+    }
+}
+
+/*
+ * printoverhead - Print the breakdown of the heap at the peak payload of
+ *   each trace, in percent of the heap at its end.  The heap grows by
+ *   "later" after the peak.
+ */
+static void printoverhead(int n, stats_t *stats)
+{
+    int i;
+    double heap;
+    struct mm_overhead *ov;
+
+    printf("%5s %7s%6s%6s%6s%6s%8s%7s%6s%6s%6s%6s%6s\n",
+	   "trace", "payload", "tags", "round", "min", "spec", "unsplit",
+	   "cached", "frag", "wild", "meta", "other", "later");
+    for (i = 0; i < n; i++) {
+	ov = &stats[i].overhead;
+	if (!stats[i].valid || stats[i].heap_size == 0) {
+	    printf("%2d%11s%6s%6s%6s%6s%8s%7s%6s%6s%6s%6s%6s\n", i, "-", "-",
+		   "-", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	heap = stats[i].heap_size / 100.0;
+	printf("%2d%11.1f%6.1f%6.1f%6.1f%6.1f%8.1f%7.1f%6.1f%6.1f%6.1f%6.1f"
+	       "%6.1f\n",
+	       i,
+	       ov->payload / heap,
+	       ov->tags / heap,
+	       ov->rounding / heap,
+	       ov->minimum / heap,
+	       ov->special / heap,
+	       ov->unsplit / heap,
+	       ov->cached / heap,
+	       ov->fragmented / heap,
+	       ov->wilderness / heap,
+	       ov->metadata / heap,
+	       ov->other / heap,
+	       ((double)stats[i].heap_size - ov->heap_size) / heap);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1013,14 +2019,30 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaCDHlLNOSs] [-A <n>] [-b <engine>] [-E <file>] [-f <file>]\n\t       [-F <file>] [-M <usecs>] [-p <file>] [-P <file>] [-t <dir>]\n\t       [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <n>     Snapshot the heap every <n> ops of each trace\n\t\t   for mmmap.\n");
+    fprintf(stderr, "\t-b <name>  Evaluate engine <name> (buddy, bitmap, oob)\n\t\t   as well.\n");
+    fprintf(stderr, "\t-C         Cache small free blocks per CPU with rseq.\n");
+    fprintf(stderr, "\t-D         Search free blocks through a dense fit index.\n");
+    fprintf(stderr, "\t-E <file>  Dump the event rings to <file> for mmtrace\n\t\t   (make TRACE=1).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <file>  Dump a sampled heap profile of each trace as\n\t\t   folded stacks to <file>, or <file>.<n> for trace <n>\n\t\t   of several.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Fill partly used hugepages first and release\n\t\t   free ones.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Segregate blocks by predicted lifetime.\n");
+    fprintf(stderr, "\t-M <usecs> Defer coalescing, purging and trimming to a\n\t\t   thread that wakes every <usecs>.\n");
+    fprintf(stderr, "\t-N         Bump allocate small blocks in a nursery.\n");
+    fprintf(stderr, "\t-O         Break down the heap overhead at peak payload.\n");
+    fprintf(stderr, "\t-p <file>  Dump a sampled heap profile of each trace for\n\t\t   pprof to <file>, or <file>.<n> for trace <n> of several.\n");
+    fprintf(stderr, "\t-P <file>  Publish allocator statistics in <file> for\n\t\t   mmstat.\n");
+    fprintf(stderr, "\t-s         Count and print allocator statistics.\n");
+    fprintf(stderr, "\t-S         Serve 4 KB to 1 MB blocks from page spans.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace in <n> threads at once as well.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
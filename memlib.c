@@ -2,7 +2,19 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The memory system is a set of independent regions, each with
+ *            its own brk pointer.  The mem_xxx functions operate on the
+ *            default region, which is created by mem_init; further regions
+ *            are created with mem_region_create.
+ *
+ *            Each region reserves its storage with mmap.  Regions of at
+ *            least HUGEPAGE_SIZE bytes start on a hugepage boundary and
+ *            are advised to the kernel as hugepage candidates, so that a
+ *            large heap is mapped by few TLB entries, and whole hugepages
+ *            of a region can be returned with mem_region_release.
  */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,10 +26,72 @@
 #include "memlib.h"
 #include "config.h"
 
+/* a simulated heap with its own brk pointer */
+struct mem_region {
+    char *start_brk;            /* points to first byte of heap */
+    char *brk;                  /* points to last byte of heap */
+    char *max_addr;             /* largest legal heap address */ 
+    size_t map_size;            /* bytes mapped at start_brk */
+    struct mem_region *prev;    /* previous region in the region list */
+    struct mem_region *next;    /* next region in the region list */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static struct mem_region mem_default;  /* region behind the mem_xxx calls */
+static struct mem_region mem_regions = /* sentinel of the region list */
+    { NULL, NULL, NULL, 0, &mem_regions, &mem_regions };
+
+/*
+ * region_init - map the storage for region r and link it into the
+ *    region list.  Storage of at least HUGEPAGE_SIZE bytes is aligned to
+ *    a hugepage boundary and advised as a hugepage candidate.  Returns 0
+ *    on success and -1 if the storage could not be mapped.
+ */
+static int region_init(mem_region_t *r, size_t maxsize)
+{
+    size_t align, len, pagesize = mem_pagesize();
+    char *map, *start;
+
+    /* reserve enough to trim the mapping to an aligned start */
+    len = (maxsize + pagesize - 1) & ~(pagesize - 1);
+    if (len == 0)
+	len = pagesize;
+    align = (len >= HUGEPAGE_SIZE) ? HUGEPAGE_SIZE : pagesize;
+    if ((map = mmap(NULL, len + align - pagesize, PROT_READ | PROT_WRITE,
+	MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+	return -1;
+    start = (char *)(((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1));
+    if (start > map)
+	munmap(map, start - map);
+    if (map + len + align - pagesize > start + len)
+	munmap(start + len, map + len + align - pagesize - (start + len));
+#ifdef MADV_HUGEPAGE
+    if (align == HUGEPAGE_SIZE)
+	madvise(start, len, MADV_HUGEPAGE);
+#endif
+
+    r->start_brk = start;
+    r->map_size = len;
+    r->max_addr = r->start_brk + maxsize;  /* max legal heap address */
+    r->brk = r->start_brk;                 /* heap is empty initially */
+
+    r->next = mem_regions.next;
+    r->prev = &mem_regions;
+    mem_regions.next->prev = r;
+    mem_regions.next = r;
+    return 0;
+}
+
+/*
+ * region_deinit - unlink region r and unmap its storage
+ */
+static void region_deinit(mem_region_t *r)
+{
+    r->prev->next = r->next;
+    r->next->prev = r->prev;
+    munmap(r->start_brk, r->map_size);
+}
+
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,13 +99,10 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (region_init(&mem_default, MAX_HEAP) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,7 +110,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    region_deinit(&mem_default);
 }
 
 /*
@@ -47,7 +118,7 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_default.brk = mem_default.start_brk;
 }
 
 /* 
@@ -57,15 +128,7 @@ void mem_reset_brk()
  */
 void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&mem_default, incr);
 }
 
 /*
@@ -73,7 +136,7 @@ void *mem_sbrk(intptr_t incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +144,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_default);
 }
 
 /*
@@ -89,7 +152,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_size(&mem_default);
 }
 
 /*
@@ -99,3 +162,125 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_total_heapsize - returns the combined size in bytes of all regions
+ */
+size_t mem_total_heapsize(void)
+{
+    mem_region_t *r;
+    size_t size = 0;
+
+    for (r = mem_regions.next; r != &mem_regions; r = r->next)
+	size += mem_region_size(r);
+    return size;
+}
+
+/*
+ * mem_in_heap - returns 1 if the bytes lo..hi lie within a single region
+ *    and 0 otherwise
+ */
+int mem_in_heap(void *lo, void *hi)
+{
+    mem_region_t *r;
+
+    for (r = mem_regions.next; r != &mem_regions; r = r->next)
+	if ((char *)lo >= r->start_brk && (char *)hi < r->brk && lo <= hi)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_default_region - return the region behind the mem_xxx functions
+ */
+mem_region_t *mem_default_region(void)
+{
+    return &mem_default;
+}
+
+/*
+ * mem_region_create - create an empty region that can grow to maxsize
+ *    bytes.  Returns NULL if the storage could not be allocated.  The
+ *    descriptor gets a page of its own rather than coming from malloc,
+ *    which may be the allocator that asked for the region.
+ */
+mem_region_t *mem_region_create(size_t maxsize)
+{
+    mem_region_t *r;
+
+    if ((r = mmap(NULL, sizeof(mem_region_t), PROT_READ | PROT_WRITE,
+	MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	return NULL;
+    if (region_init(r, maxsize) < 0) {
+	munmap(r, sizeof(mem_region_t));
+	return NULL;
+    }
+    return r;
+}
+
+/*
+ * mem_region_destroy - release a region and all of its storage at once
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    assert(r != &mem_default);
+    region_deinit(r);
+    munmap(r, sizeof(mem_region_t));
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for region r
+ */
+void *mem_region_sbrk(mem_region_t *r, intptr_t incr)
+{
+    char *old_brk = r->brk;
+
+    if ( (incr < 0) || ((r->brk + incr) > r->max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    r->brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_release - return the whole hugepages within the len bytes
+ *    at addr in region r to the OS.  Their contents read as zero when
+ *    they are next touched.  Returns the number of bytes released.
+ */
+size_t mem_region_release(mem_region_t *r, void *addr, size_t len)
+{
+    uintptr_t lo = ((uintptr_t)addr + HUGEPAGE_SIZE - 1) &
+	~(uintptr_t)(HUGEPAGE_SIZE - 1);
+    uintptr_t hi = ((uintptr_t)addr + len) & ~(uintptr_t)(HUGEPAGE_SIZE - 1);
+
+    assert((char *)addr >= r->start_brk && (char *)addr + len <= r->max_addr);
+    if (hi <= lo || madvise((void *)lo, hi - lo, MADV_DONTNEED) != 0)
+	return 0;
+    return hi - lo;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of region r
+ */
+void *mem_region_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last byte of region r
+ */
+void *mem_region_hi(mem_region_t *r)
+{
+    return (void *)(r->brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of region r in bytes
+ */
+size_t mem_region_size(mem_region_t *r)
+{
+    return (size_t)(r->brk - r->start_brk);
+}
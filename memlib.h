@@ -6,3 +6,20 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_total_heapsize(void);
+int mem_in_heap(void *lo, void *hi);
+
+/* Regions of at least this many bytes are aligned to hugepages */
+#define HUGEPAGE_SIZE (1 << 21)
+
+/* Independent regions, each modeling a heap with its own brk pointer */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(size_t maxsize);
+void mem_region_destroy(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, intptr_t incr);
+size_t mem_region_release(mem_region_t *r, void *addr, size_t len);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+size_t mem_region_size(mem_region_t *r);
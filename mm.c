@@ -13,13 +13,33 @@
  * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
  */
 
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
+#include "config.h"
 #include "memlib.h"
 #include "mm.h"
+#include "mm_bitmap.h"
+#include "mm_buddy.h"
+#include "mm_cpucache.h"
+#include "mm_oob.h"
+#include "mm_probe.h"
+#include "mm_profile.h"
+#include "mm_span.h"
+#include "mm_trace.h"
+#include "mm_write.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -38,12 +58,22 @@ team_t team = {
 	"aws6@rice.edu"
 };
 
+/*
+ * Building with -DMM_BACKEND_BUDDY ("make BACKEND=buddy") makes mm_init,
+ * mm_malloc, mm_free and mm_realloc forward to the buddy engine in
+ * mm_buddy.c instead of the heaps below.  Likewise, -DMM_BACKEND_BITMAP
+ * ("make BACKEND=bitmap") selects the bitmap engine in mm_bitmap.c, and
+ * -DMM_BACKEND_OOB ("make BACKEND=oob") selects the engine in mm_oob.c,
+ * which keeps the boundary tags out of band.
+ */
+
 /* Basic constants and macros: */
 #define WSIZE      sizeof(void *) // Word and header/footer size (bytes)
 #define DSIZE      (2 * WSIZE)    // Doubleword size (bytes)
 #define CHUNKSIZE  (1 << 12)      // Extend heap by this amount (bytes)
 
 #define MAX(x, y)  ((x) > (y) ? (x) : (y))  
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
 
 // Pack a size and allocated bit into a word.
 #define PACK(size, alloc)  ((size) | (alloc))
@@ -65,28 +95,331 @@ team_t team = {
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
 // rounds up to the nearest multiple of ALIGNMENT 
-#define ROUND(size) (((size) + (DSIZE-1)) & ~0x7)
+#define ROUND(size) (((size) + (DSIZE-1)) & ~(DSIZE-1))
+
+// Largest block that the per-CPU caches hold, and the class of a block.
+#define CPUCACHE_MAXBLOCK  ((CPUCACHE_CLASSES + 1) * DSIZE)
+#define CPUCACHE_CLASS(size)  ((size) / DSIZE - 2)
+
+// Default time after which the maintenance thread empties the per-CPU
+// caches of a CPU that has not used them (microseconds).
+#define CPUCACHE_IDLE  100000
+
+/*
+ * Per-class bins: while several threads share the default heap and the
+ * per-CPU caches are off, freed blocks of up to BIN_MAXBLOCK bytes go onto
+ * per-size-class stacks, linked through the first word of each payload,
+ * instead of into the free list.  Each bin has its own lock, and its
+ * blocks stay marked allocated, so that no neighbor coalesces with them.
+ * A bin that runs dry takes a batch of fits from the free list under the
+ * heap lock, or else carves a batch from the top of the heap under the
+ * extension lock alone, and a bin that grows past BIN_CAP blocks returns
+ * a batch to the free list.  When the heap can no longer grow, it
+ * consolidates the bins whose locks it can take without waiting, and
+ * leaves the rest for a later miss, so that it never waits for a bin
+ * while holding the heap lock.  A bin's lock is never held while waiting
+ * for another lock, and the heap lock is taken before the extension lock.
+ */
+#define BIN_CLASSES    31  // Number of bins
+#define BIN_MAXBLOCK   ((BIN_CLASSES + 1) * DSIZE)
+#define BIN_CLASS(size)  ((size) / DSIZE - 2)
+#define BIN_CAP        64  // Most blocks per bin before a batch is returned
+#define BIN_BATCH_MAX  16  // Most blocks moved per batch
+
+// Blocks moved per batch for blocks of "size" bytes: about 2 KB of them.
+#define BIN_BATCH(size)  MAX(4, MIN(BIN_BATCH_MAX, 2048 / (size)))
+
+// Round an address down or up to a hugepage boundary.
+#define HP_DOWN(p)  ((uintptr_t)(p) & ~(uintptr_t)(HUGEPAGE_SIZE - 1))
+#define HP_UP(p)    HP_DOWN((uintptr_t)(p) + HUGEPAGE_SIZE - 1)
+
+// Free blocks release their hugepages only once they span this many, so
+// that churn within a few hugepages does not fault them back in.
+#define HP_RELEASE  (2 * HUGEPAGE_SIZE)
 
 typedef struct free_blk {
 	void *prev;
 	void *next;
 } free_blk;
 
+/*
+ * A heap: a memlib region holding a prologue, the dummy head of the free
+ * list, the blocks, and an epilogue.  Heaps created by mm_heap_create keep
+ * this struct at the start of their own region, so destroying the region
+ * releases everything at once.
+ */
+struct mm_heap {
+	mem_region_t *region;        // Backing memory of this heap
+	char *heap_listp;            // Pointer to first block
+	char *heap_end;              // First byte past the epilogue header
+	struct free_blk *free_listp; // Pointer to first free block
+	struct fit_index *index;     // Dense free block index, or NULL
+};
+
+/*
+ * A dense fit index: instead of the free list, a heap may keep its free
+ * blocks in per-size-class arrays of block sizes and block offsets, in
+ * units of DSIZE from the start of the heap's region.  Class c holds the
+ * blocks of 2^(c+5) up to 2^(c+6) - 1 bytes, and the last class holds
+ * every larger block.  find_fit compares the contiguous sizes of a class
+ * several at a time and only touches the block that it chooses.  The
+ * first word of a free block's payload holds its slot in its class, so
+ * that removal can move the last entry of the class into the vacated
+ * slot.  The index lives at the start of its own region, followed by the
+ * arrays of each class in turn.  The region is sbrk'd as a class outgrows
+ * its arrays, so that the index counts toward the total heap size.
+ */
+#define FIT_CLASSES  20  // Number of size classes in a fit index
+#define FIT_MINCAP   4   // Entries in the first arrays of a class
+
+struct fit_class {
+	uint32_t *sizes;    // Sizes of the free blocks in units of DSIZE
+	uint32_t *offsets;  // Offsets of the free blocks in units of DSIZE
+	uint32_t count;     // Number of free blocks in the class
+	uint32_t cap;       // Number of entries that the arrays can hold
+};
+
+struct fit_index {
+	mem_region_t *region;  // Backing memory of this index
+	char *base;            // Address that the offsets are relative to
+	unsigned nonempty;     // Bit c is set if class c is nonempty
+	struct fit_class classes[FIT_CLASSES];
+};
+
+/*
+ * Lifetime-segregated placement: blocks are grouped into lifetime classes
+ * by the log2 of their size.  One allocation in LT_SAMPLE is recorded in a
+ * table of sampled blocks together with the allocation clock, and freeing
+ * a sampled block folds its lifetime into a moving average for its class.
+ * Classes whose average lifetime is below MM_SHORT_LIFETIME operations are
+ * placed in a separate short-lived heap, so that long-lived blocks do not
+ * pin the free space left behind by short-lived ones.
+ */
+#define LT_CLASSES     20              // Number of lifetime classes
+#define LT_TABLEBITS   12              // log2 of the sample table size
+#define LT_TABLESIZE   (1 << LT_TABLEBITS)
+#define LT_SAMPLE      8               // Sample one in this many mallocs
+#define LT_MINSAMPLES  4               // Samples needed to predict a class
+
+// Returns the slot of the sample table where the search for bp starts.
+#define LT_HASH(bp)  \
+	((uint32_t)((uintptr_t)(bp) / DSIZE) * 2654435761u >> \
+	    (32 - LT_TABLEBITS))
+
+/*
+ * The nursery: an optional region of pages in which small requests are
+ * served by bumping a pointer through the current page.  Each object has
+ * a one-word header holding its size, and each page counts its live
+ * objects.  mm_free only decrements that count, and a page whose count
+ * drops to zero is recycled as a whole.  Objects never move, so a
+ * long-lived survivor simply keeps its page from being recycled.
+ */
+#define NURSERY_PAGESIZE  (1 << 12) // Size of a nursery page (bytes)
+#define NURSERY_PAGES     256       // Maximum number of nursery pages
+#define NURSERY_MAXSIZE   256       // Largest request served (bytes)
+
+// Returns true if bp lies in a nursery page.
+#define IN_NURSERY(bp)  \
+	((size_t)((char *)(bp) - nursery_base) < nursery_extent)
+
+/*
+ * Background maintenance: while the maintenance thread runs, the entry
+ * points of the default heap hold heap_mutex, and freeing a block of the
+ * default heap only pushes it on a stack of deferred frees, linked through
+ * the first word of each payload.  Every interval, the thread coalesces up
+ * to MAINT_BATCH deferred frees, releases the hugepages of up to
+ * MAINT_BATCH free blocks that coalesce queued as purge candidates, and
+ * trims the wilderness to MAINT_TOP_PAD bytes of resident memory.  A
+ * malloc that finds no fit coalesces every deferred free itself before it
+ * grows the heap.
+ */
+#define MAINT_BATCH    64             // Work items per wakeup
+#define MAINT_PURGES   256            // Most queued purge candidates
+#define MAINT_TOP_PAD  HUGEPAGE_SIZE  // Wilderness bytes left resident
+
+/*
+ * Allocation statistics: while counting is on, each thread counts its
+ * requests in a thread-local shard, so that counting takes no lock and
+ * shares no cache line with another thread.  Only its owner writes a
+ * shard.  mm_stats sums the shards of the live threads under stats_mutex,
+ * together with "stats_retired", into which the shard of an exiting
+ * thread is folded.  A thread that frees blocks allocated by another
+ * counts negative live bytes, so only the sum is meaningful.  A page
+ * published with mm_stats_publish is rewritten at most every
+ * STATS_INTERVAL when the heap grows, since each update walks the free
+ * blocks.
+ */
+#define STATS_INTERVAL  10000000  // Least nanoseconds between growth updates
+
+enum {
+	STATS_MALLOCS,   // Calls to mm_malloc
+	STATS_FREES,     // Calls to mm_free
+	STATS_REALLOCS,  // Calls to mm_realloc
+	STATS_INPLACE,   // Reallocs that kept their block
+	STATS_COPIES,    // Reallocs that moved their block
+	STATS_SBRKS,     // Extensions of the heap regions
+	STATS_LIVE,      // Net bytes of blocks allocated, modulo 2^64
+	STATS_COUNTERS
+};
+
+struct stats_shard {
+	unsigned long count[STATS_COUNTERS];
+	bool linked;               // Is the shard on "stats_shards"?
+	struct stats_shard *next;  // Next shard of a live thread
+};
+
+struct bin {
+	pthread_mutex_t lock; // Protects the fields below
+	void *head;           // Stack of binned blocks
+	unsigned count;       // Number of binned blocks
+};
+
+struct lt_class {
+	size_t avg;       // Moving average of the sampled lifetimes
+	unsigned samples; // Number of sampled lifetimes, saturating
+};
+
+struct lt_sample {
+	void *bp;         // Sampled block, or NULL for an empty slot
+	size_t birth;     // Allocation clock when the block was allocated
+	unsigned cls;     // Lifetime class of the block
+};
+
 /* Global variables: */
-static char *heap_listp; // Pointer to first block
-static struct free_blk *free_listp; // Pointer to first free block  
+static struct mm_heap default_heap; // Heap behind the mm_malloc family
+static bool fit_index_enabled;      // Do new heaps use a fit index?
+static bool span_enabled;           // Are medium requests served by spans?
+static bool hugepage_enabled;       // Are heaps laid out by hugepages?
+static bool threads_enabled;        // May several threads use the heap?
+static bool cpucache_enabled;       // Are per-CPU caches requested?
+static bool cpucache_active;        // Are the per-CPU caches in use?
+static unsigned cpucache_idle = CPUCACHE_IDLE;  // Idle period (usecs)
+static bool bins_active;            // Are the per-class bins in use?
+static struct bin bins[BIN_CLASSES];
+
+static bool lt_enabled;              // Is lifetime segregation on?
+static struct mm_heap *short_heap;   // Heap for predicted short-lived blocks
+static size_t lt_clock;              // Number of operations so far
+static unsigned lt_tick;             // Counts mallocs between samples
+static unsigned lt_count;            // Number of sampled blocks in the table
+static struct lt_class lt_classes[LT_CLASSES];
+static struct lt_sample lt_table[LT_TABLESIZE];
+
+static bool nursery_enabled;        // Is the nursery on?
+static mem_region_t *nursery;       // Region holding the nursery pages
+static char *nursery_base;          // First nursery page
+static size_t nursery_extent;       // Bytes of nursery pages in use
+static char *nursery_bump;          // Next header in the current page
+static char *nursery_limit;         // End of the current page
+static unsigned nursery_page;       // Index of the current page
+static unsigned nursery_npages;     // Number of pages obtained so far
+static unsigned nursery_nfree;      // Number of recyclable pages
+static unsigned nursery_live[NURSERY_PAGES];  // Live objects per page
+static unsigned nursery_free[NURSERY_PAGES];  // Stack of recyclable pages
+
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t extend_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t maint_scavenged = PTHREAD_COND_INITIALIZER;
+static pthread_t maint_thread;      // The maintenance thread
+static bool maint_running;          // Is the maintenance thread running?
+static bool maint_stopping;         // Has the thread been asked to stop?
+static bool maint_scavenging;       // Is it scavenging the per-CPU caches?
+static bool maint_sweep;            // Did purge candidates overflow?
+static unsigned maint_interval;     // Microseconds between wakeups
+static void *maint_deferred;        // Stack of deferred frees
+static unsigned maint_npurges;      // Number of queued purge candidates
+static void *maint_purges[MAINT_PURGES];  // Queued purge candidates
+static void *maint_trimmed;         // Wilderness at the last trim
+static size_t maint_trimsize;       // Its size at the last trim
+static struct mm_maint_stats maint_stats;
+
+static bool stats_enabled;          // Are requests counted?
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;     // Unlinks a thread's shard at its exit
+static struct stats_shard *stats_shards;  // Shards of the live threads
+static struct stats_shard stats_retired;  // Sum of the exited threads
+static __thread struct stats_shard stats_local;  // This thread's shard
+static struct mm_stats_page *stats_page;  // Published statistics, or NULL
+static uint64_t stats_published;    // Time of the last update (ns)
 
 /* Function prototypes for internal helper routines: */
-static void *coalesce(void *bp);
-static void *extend_heap(size_t words);
-static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
-static void add_free(struct free_blk *bp);
-static void remove_free(struct free_blk *bp);
+static int heap_init(struct mm_heap *heap);
+static size_t adjust_size(size_t size);
+static void *coalesce(struct mm_heap *heap, void *bp);
+static void *extend_heap(struct mm_heap *heap, size_t words);
+static void *find_fit(struct mm_heap *heap, size_t asize);
+static void *wilderness(struct mm_heap *heap);
+static bool touches_released(void *bp, size_t asize);
+static void release_hugepages(struct mm_heap *heap, void *bp, char *lo,
+    char *hi);
+static void place(struct mm_heap *heap, void *bp, size_t asize);
+static void add_free(struct mm_heap *heap, struct free_blk *bp);
+static void remove_free(struct mm_heap *heap, struct free_blk *bp);
+static struct fit_index *index_create(struct mm_heap *heap, size_t maxsize);
+static void index_grow(struct fit_index *index, unsigned c);
+static unsigned index_class(size_t size);
+static void *index_fit(struct fit_index *index, size_t asize, void *wild);
+static size_t index_scan(const uint32_t *sizes, size_t i, size_t n,
+    uint32_t need);
+static unsigned lifetime_class(size_t size);
+static struct mm_heap *lifetime_heap(void *bp);
+static void lifetime_sample(void *bp, unsigned cls);
+static void lifetime_observe(void *bp);
+static void *nursery_malloc(size_t size);
+static void nursery_free_block(void *bp);
+static void *nursery_realloc(void *ptr, size_t size);
+static bool nursery_next_page(void);
+static int default_init(void);
+static void *front_malloc(size_t size);
+static void front_free(void *bp);
+static void *default_malloc(size_t size);
+static void default_free(void *bp);
+static void *default_realloc(void *ptr, size_t size);
+static void *cpucache_fill(unsigned cls);
+static void *cpucache_refill(size_t size);
+static void cpucache_spill(unsigned cls, void *bp);
+static void cpucache_release(unsigned cls, void **blocks, unsigned n);
+static void *bin_malloc(size_t size, size_t asize);
+static void bin_free(void *bp);
+static unsigned bin_refill(size_t asize, void **blocks);
+static size_t bin_flush(void);
+static unsigned heap_carve(struct mm_heap *heap, size_t asize, unsigned n,
+    void **blocks);
+static void heap_lock(void);
+static void heap_unlock(void);
+static void extend_lock(struct mm_heap *heap);
+static void extend_unlock(struct mm_heap *heap);
+static void *maint_main(void *arg);
+static void maint_work(size_t budget);
+static size_t drain_deferred(size_t budget);
+static size_t purge_block(void *bp);
+static void purge_cancel(void *bp);
+static size_t block_size(void *bp);
+static struct stats_shard *stats_shard(void);
+static void stats_link(void);
+static void stats_key_create(void);
+static void stats_unlink(void *arg);
+static void stats_add(struct stats_shard *sh, unsigned c, unsigned long n);
+static void stats_fold(struct stats_shard *sum, struct stats_shard *sh);
+static void stats_malloc(void *bp);
+static void stats_free(void *bp);
+static void stats_realloc(void *ptr, size_t oldsize, void *newptr,
+    size_t size);
+static void stats_free_block(struct mm_stats *stats, size_t size);
+static void stats_collect(struct mm_stats *stats);
+static void stats_publish(void);
+static bool stats_due(void);
+static void overhead_heap(struct mm_heap *heap, struct mm_overhead *overhead,
+    void **ptrs, const size_t *sizes, size_t n);
+static void walk_heap(struct mm_heap *heap, mm_walk_t *callback, void *ctx);
+static unsigned long snapshot_heap(struct mm_heap *heap,
+    struct mm_snapshot_heap *sh, unsigned long *words);
 
 /* Function prototypes for heap consistency checker routines: */
 static void checkblock(void *bp);
-static void checkheap(bool verbose);
+static void checkheap(struct mm_heap *heap, bool verbose);
 static void printblock(void *bp); 
 
 /* 
@@ -100,29 +433,121 @@ static void printblock(void *bp);
 int
 mm_init(void) 
 {
-	// Create the initial empty heap.
-	if ((heap_listp = mem_sbrk(8 * WSIZE)) == (void *)-1)
-		return (-1);
-
-	free_listp = (struct free_blk*) (heap_listp + (4 * WSIZE));
+	int ret;
+
+#if defined(MM_BACKEND_BUDDY)
+	return (buddy_init());
+#elif defined(MM_BACKEND_BITMAP)
+	return (bitmap_init());
+#elif defined(MM_BACKEND_OOB)
+	return (oob_init());
+#endif
+	heap_lock();
+	ret = default_init();
+	heap_unlock();
+	return (ret);
+}
 
-	PUT(heap_listp, 0);                            // Alignment padding.
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); // Prologue header. 
-	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); // Prologue footer.
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared.
+ *
+ * Effects:
+ *   Initialize the default heap and the tiers in front of it.  Returns 0
+ *   if they were successfully initialized and -1 otherwise.
+ */
+static int
+default_init(void)
+{
+	struct stats_shard *sh;
+	unsigned c, cls;
+
+	// Let the maintenance thread finish with the per-CPU caches, which
+	// it scavenges without the heap lock, before they go.
+	while (maint_scavenging)
+		pthread_cond_wait(&maint_scavenged, &heap_mutex);
+
+	// Forget the heap and predictor state of any previous run.
+	if (short_heap != NULL) {
+		mm_heap_destroy(short_heap);
+		short_heap = NULL;
+	}
+	lt_clock = 0;
+	lt_tick = 0;
+	lt_count = 0;
+	memset(lt_classes, 0, sizeof(lt_classes));
+	memset(lt_table, 0, sizeof(lt_table));
+	if (nursery != NULL) {
+		mem_region_destroy(nursery);
+		nursery = NULL;
+	}
+	nursery_base = NULL;
+	nursery_extent = 0;
+	nursery_bump = nursery_limit = NULL;
+	nursery_npages = 0;
+	nursery_nfree = 0;
+	span_deinit();
+	cpucache_deinit();
+	cpucache_active = false;
+	if (bins_active) {
+		for (cls = 0; cls < BIN_CLASSES; cls++)
+			pthread_mutex_destroy(&bins[cls].lock);
+		bins_active = false;
+	}
+	maint_deferred = NULL;
+	maint_npurges = 0;
+	maint_sweep = false;
+	maint_trimmed = NULL;
+
+	// Clear the counts of the exited and the live threads.
+	pthread_mutex_lock(&stats_mutex);
+	memset(stats_retired.count, 0, sizeof(stats_retired.count));
+	for (sh = stats_shards; sh != NULL; sh = sh->next) {
+		for (c = 0; c < STATS_COUNTERS; c++)
+			__atomic_store_n(&sh->count[c], 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&stats_mutex);
+	profile_reset();
 
-	PUT(heap_listp + (3 * WSIZE), PACK((4 * WSIZE), 1)); // Dummy head
-	                                                     // header.
-	PUT(heap_listp + (4 * WSIZE), (size_t) free_listp); // Dummy head
-	                                                    // prev.
-	PUT(heap_listp + (5 * WSIZE), (size_t) free_listp);// Dummy head next
-	PUT(heap_listp + (6 * WSIZE), PACK((4 * WSIZE), 1)); // Dummy head 
-  	                                                     // footer.	
-	PUT(heap_listp + (7 * WSIZE), PACK(0, 1));     // Epilogue header.
-	heap_listp += (2 * WSIZE);
+	if (default_heap.index != NULL) {
+		mem_region_destroy(default_heap.index->region);
+		default_heap.index = NULL;
+	}
 
-	// Extend the empty heap with a free block of CHUNKSIZE bytes.
-	if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+	default_heap.region = mem_default_region();
+	if (fit_index_enabled && (default_heap.index =
+	    index_create(&default_heap, MAX_HEAP)) == NULL)
+		return (-1);
+	if (heap_init(&default_heap) == -1)
+		return (-1);
+	if (lt_enabled && (short_heap = mm_heap_create(0)) == NULL)
 		return (-1);
+	if (nursery_enabled) {
+		if ((nursery = mem_region_create(NURSERY_PAGES *
+		    NURSERY_PAGESIZE)) == NULL)
+			return (-1);
+		nursery_base = mem_region_lo(nursery);
+	}
+	if (span_enabled && span_init() == -1)
+		return (-1);
+
+	// The caches front the default heap only.  Without rseq, every
+	// request takes the locked heap instead.
+	if (cpucache_enabled && !nursery_enabled && !lt_enabled)
+		cpucache_active = (cpucache_init() == 0);
+
+	// Shared heaps without per-CPU caches use the per-class bins.
+	if (threads_enabled && !cpucache_active && !nursery_enabled &&
+	    !lt_enabled) {
+		for (cls = 0; cls < BIN_CLASSES; cls++) {
+			pthread_mutex_init(&bins[cls].lock, NULL);
+			bins[cls].head = NULL;
+			bins[cls].count = 0;
+		}
+		bins_active = true;
+	}
+	if (stats_page != NULL)
+		stats_publish();
 	return (0);
 }
 
@@ -131,49 +556,124 @@ mm_init(void)
  *   None.
  *
  * Effects:
- *   Allocate a block with at least "size" bytes of payload, unless "size" is
- *   zero.  Returns the address of this block if the allocation was successful
- *   and NULL otherwise.
+ *   Allocate a block with at least "size" bytes of payload from the default
+ *   heap, unless "size" is zero.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
  */
 void *
 mm_malloc(size_t size) 
 {
-	size_t asize;      // Adjusted block size
-	size_t extendsize; // Amount to extend heap if no fit
 	void *bp;
 
-	// Ignore spurious requests.
-	if (size <= 0)
-		return (NULL);
+#if defined(MM_BACKEND_BUDDY)
+	return (buddy_malloc(size));
+#elif defined(MM_BACKEND_BITMAP)
+	return (bitmap_malloc(size));
+#elif defined(MM_BACKEND_OOB)
+	return (oob_malloc(size));
+#endif
+	TRACE_BEGIN();
+	bp = front_malloc(size);
+	if (stats_enabled)
+		stats_malloc(bp);
+	PROFILE_MALLOC(bp, size);
+	TRACE_END(MM_TRACE_MALLOC, size, bp, NULL);
+	PROBE2(malloc, size, bp);
+	return (bp);
+}
 
-	// Adjust block size to include overhead and alignment reqs.
-	if (size <= DSIZE)
-		asize = 2 * DSIZE;
-	else
-		asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
-	// Harded coded cases to drastically improve throughput.
-	if (size == 448)
-		asize = 528;
-	if (size == 112)
-		asize = 144;
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_malloc for the per-CPU caches or the bins, and the default heap
+ *   behind them.
+ */
+static void *
+front_malloc(size_t size)
+{
+	size_t asize;
+	unsigned cls;
+	void *bp;
 
-	// Search the free list for a fit.
-	if ((bp = find_fit(asize)) != NULL) {
-		place(bp, asize);
+	// Pop a block of the request's class from this CPU's cache.  When
+	// it is empty, refill it with a batch from the transfer cache, or
+	// else from the heap under the lock.
+	if (cpucache_active && size != 0 && size <= CPUCACHE_MAXBLOCK &&
+	    (asize = adjust_size(size)) <= CPUCACHE_MAXBLOCK) {
+		cls = CPUCACHE_CLASS(asize);
+		if ((bp = cpucache_pop(cls)) != NULL)
+			return (bp);
+
+		// A miss makes room for the batch that refills the cache.
+		cpucache_grow(cls);
+		if ((bp = cpucache_fill(cls)) != NULL)
+			return (bp);
+		heap_lock();
+		bp = cpucache_refill(size);
+		heap_unlock();
 		return (bp);
 	}
 
-	// No fit found.  Get more memory and place the block.
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize / WSIZE)) == NULL)  
+	// Pop a block of the request's class from its bin.
+	if (bins_active && size != 0 && size <= BIN_MAXBLOCK &&
+	    (asize = adjust_size(size)) <= BIN_MAXBLOCK)
+		return (bin_malloc(size, asize));
+	heap_lock();
+	bp = default_malloc(size);
+	heap_unlock();
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared.
+ *
+ * Effects:
+ *   mm_malloc for the default heap and the tiers in front of it.
+ */
+static void *
+default_malloc(size_t size)
+{
+	struct mm_heap *heap = &default_heap;
+	struct lt_class *lc;
+	unsigned cls;
+	void *bp;
+
+	// Serve small requests from the nursery while it has pages.
+	if (nursery != NULL && size <= NURSERY_MAXSIZE && size != 0 &&
+	    (bp = nursery_malloc(size)) != NULL)
+		return (bp);
+
+	// Serve medium requests from page spans while the tier has room.
+	if (span_enabled && size >= SPAN_MINSIZE && size <= SPAN_MAXSIZE &&
+	    (bp = span_malloc(size)) != NULL)
+		return (bp);
+
+	if (!lt_enabled)
+		return (mm_heap_malloc(heap, size));
+
+	// Ignore spurious requests.
+	if (size == 0)
 		return (NULL);
-	place(bp, asize);
+
+	// Place the block by the predicted lifetime of its class.
+	lt_clock++;
+	cls = lifetime_class(size);
+	lc = &lt_classes[cls];
+	if (lc->samples >= LT_MINSAMPLES && lc->avg < MM_SHORT_LIFETIME)
+		heap = short_heap;
+	if ((bp = mm_heap_malloc(heap, size)) != NULL &&
+	    ++lt_tick % LT_SAMPLE == 0)
+		lifetime_sample(bp, cls);
 	return (bp);
-} 
+}
 
 /* 
  * Requires:
- *   "bp" is either the address of an allocated block or NULL.
+ *   "bp" is either the address of a block allocated by mm_malloc or
+ *   mm_realloc or NULL.
  *
  * Effects:
  *   Free a block.
@@ -181,259 +681,2633 @@ mm_malloc(size_t size)
 void
 mm_free(void *bp)
 {
-	size_t size;
-
-	// Ignore spurious requests.
-	if (bp == NULL)
-		return;
 
-	// Free and coalesce the block.
-	size = GET_SIZE(HDRP(bp));
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	coalesce(bp);
+#if defined(MM_BACKEND_BUDDY)
+	buddy_free(bp);
+	return;
+#elif defined(MM_BACKEND_BITMAP)
+	bitmap_free(bp);
+	return;
+#elif defined(MM_BACKEND_OOB)
+	oob_free(bp);
+	return;
+#endif
+	PROBE1(free, bp);
+	TRACE_BEGIN();
+	if (stats_enabled)
+		stats_free(bp);
+	PROFILE_FREE(bp);
+	front_free(bp);
+	TRACE_END(MM_TRACE_FREE, 0, bp, NULL);
 }
 
 /*
  * Requires:
- *   "ptr" is either the address of an allocated block or NULL.
+ *   "bp" is either the address of a block allocated by mm_malloc or
+ *   mm_realloc or NULL.
  *
  * Effects:
- *   Reallocates the block "ptr" to a block with at least "size" bytes of
- *   payload, unless "size" is zero.  If "size" is zero, frees the block
- *   "ptr" and returns NULL.  If the block "ptr" is already a block with at
- *   least "size" bytes of payload, then "ptr" may optionally be returned.
- *   Otherwise, a new block is allocated and the contents of the old block
- *   "ptr" are copied to that new block.  Returns the address of this new
- *   block if the allocation was successful and NULL otherwise.
+ *   mm_free for the per-CPU caches or the bins, and the default heap
+ *   behind them.
  */
-void *mm_realloc(void *ptr, size_t size) 
+static void
+front_free(void *bp)
 {
-	size_t asize = MAX(ROUND(size) + DSIZE, 24);
-	size_t esize;
-	size_t oldsize;
-	void *newptr;
-
-	// If size == 0 then this is just free, and return NULL. 
-	if (size == 0) {
-		mm_free(ptr);
-		return (NULL);
-
-		// We need to see whether or not we have enough space to
-		// reallocate.
-	} else if (ptr == NULL) {
-		return mm_malloc(asize);
-	} else {
-		// This is the  amount of space our current free block has.
-		oldsize = GET_SIZE(HDRP(ptr));
-		
-		// Our current block has at least the minimum amount of space.
-		if (asize <= oldsize) {
-			return (ptr);
+	unsigned cls;
+
+	// Push a small block of the default heap onto this CPU's cache.  A
+	// full cache grows if it may, and otherwise moves a batch out.
+	if (cpucache_active && bp != NULL && !span_owns(bp) &&
+	    GET_SIZE(HDRP(bp)) <= CPUCACHE_MAXBLOCK) {
+		cls = CPUCACHE_CLASS(GET_SIZE(HDRP(bp)));
+		if (cpucache_push(cls, bp) != 0 && (cpucache_grow(cls) != 0 ||
+		    cpucache_push(cls, bp) != 0))
+			cpucache_spill(cls, bp);
+		return;
+	}
 
-	        // We need to get more free space.
-		} else {
-			esize = (oldsize + GET_SIZE(HDRP(NEXT_BLKP(ptr))));
-
-			// The next block has enough space to extend to.
-			if (GET_ALLOC(HDRP(NEXT_BLKP(ptr))) == 0 &&
-			    (esize >= asize)) {
-					    remove_free((struct free_blk*)
-							NEXT_BLKP(ptr));
-					    PUT(HDRP(ptr), PACK(esize, 1));
-					    PUT(FTRP(ptr), PACK(esize, 1));
-					    return (ptr);
-				
-			        // The next block does not have enough space
-				// to account for our requested space. We must
-				// malloc a different memory block
-				    } else {
-					    newptr = mm_malloc(asize);
-					    place(newptr, asize);
-					    memcpy(newptr, ptr, asize);
-					    mm_free(ptr);
-					    return (newptr);
-				    }
-		}
+	// Push a small block of the default heap onto its bin.
+	if (bins_active && bp != NULL && !span_owns(bp) &&
+	    GET_SIZE(HDRP(bp)) <= BIN_MAXBLOCK) {
+		bin_free(bp);
+		return;
 	}
+	heap_lock();
+	default_free(bp);
+	heap_unlock();
 }
 
-
-/*
- * The following routines are internal helper routines.
- */
-
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   "heap_mutex" is held if the heap is shared.
  *
  * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ *   mm_free for the default heap and the tiers in front of it.  While
+ *   the maintenance thread runs, a block of the default heap is deferred
+ *   to it instead of being coalesced.
  */
-static void *
-coalesce(void *bp) 
+static void
+default_free(void *bp)
 {
-	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-	size_t size = GET_SIZE(HDRP(bp));
-
-	
-	// The previous and next blocks are occupied and can't be combined.
-	if (prev_alloc && next_alloc) {                 /* Case 1 */
-		add_free((struct free_blk*) bp);
-		return (bp);
+	struct mm_heap *heap;
 
-	// The next block is free and can be combined with the current block.
-	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		// Remove the next block from the free list.
-		remove_free((struct free_blk*) NEXT_BLKP(bp));
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
+	if (IN_NURSERY(bp)) {
+		nursery_free_block(bp);
+		return;
+	}
+	if (span_owns(bp)) {
+		span_free(bp);
+		return;
+	}
 
-        // The prev block is free and can be combined with the current block.
-	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		// Shift the pointer to represent the combined start address.
-	 	bp = PREV_BLKP(bp);
-		// Remove the prev block from the free list.
-		remove_free((struct free_blk*) bp);
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
+	// Ignore spurious requests.
+	if (bp == NULL)
+		return;
 
-	// Both blocks are free and can be combined with the current block.
-	} else {                                        /* Case 4 */
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		// Remove the previous block from the free list.
-		remove_free((struct free_blk*) PREV_BLKP(bp));
-		// Remove the next block from the free list.
-		remove_free((struct free_blk*) NEXT_BLKP(bp));
-		bp = PREV_BLKP(bp);
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
+	heap = &default_heap;
+	if (lt_enabled) {
+		lt_clock++;
+		if (lt_count > 0)
+			lifetime_observe(bp);
+		heap = lifetime_heap(bp);
 	}
-	// Add the correct block of memory to the free list.
-	add_free((struct free_blk*) bp);
-	return (bp);
+	if (maint_running && heap == &default_heap) {
+		*(void **)bp = maint_deferred;
+		maint_deferred = bp;
+		return;
+	}
+	mm_heap_free(heap, bp);
 }
 
-/* 
+/*
  * Requires:
- *   None.
+ *   "ptr" is either the address of a block allocated by mm_malloc or
+ *   mm_realloc or NULL.
  *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Reallocates the block "ptr" within the heap that holds it.  See
+ *   mm_heap_realloc.
  */
-static void *
-extend_heap(size_t words) 
+void *
+mm_realloc(void *ptr, size_t size) 
 {
-	size_t size;
-	void *bp;
-		
-
-	// Allocate an even number of words to maintain alignment. 
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-	if ((bp = mem_sbrk(size)) == (void *)-1)  
-		return (NULL);
-
-	// Initialize free block header/footer and the epilogue header. 
-	PUT(HDRP(bp), PACK(size, 0));         // Free block header 
-	PUT(FTRP(bp), PACK(size, 0));         // Free block footer 
-	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // New epilogue header 
+	size_t oldsize = 0;
+	void *newptr;
 
-	// Coalesce if the previous block was free.
-	return (coalesce(bp));
+#if defined(MM_BACKEND_BUDDY)
+	return (buddy_realloc(ptr, size));
+#elif defined(MM_BACKEND_BITMAP)
+	return (bitmap_realloc(ptr, size));
+#elif defined(MM_BACKEND_OOB)
+	return (oob_realloc(ptr, size));
+#endif
+	if (stats_enabled && ptr != NULL)
+		oldsize = block_size(ptr);
+	TRACE_BEGIN();
+
+	// The profiler sees a reallocation as a free and a malloc.  The
+	// old block stays live if the reallocation failed.
+	heap_lock();
+	newptr = default_realloc(ptr, size);
+	if (newptr != NULL || size == 0)
+		PROFILE_FREE(ptr);
+	heap_unlock();
+	if (stats_enabled)
+		stats_realloc(ptr, oldsize, newptr, size);
+	PROFILE_MALLOC(newptr, newptr != NULL ? size : 0);
+	TRACE_END(MM_TRACE_REALLOC, size, newptr, ptr);
+	PROBE3(realloc, ptr, size, newptr);
+	return (newptr);
 }
 
 /*
  * Requires:
- *   None.
+ *   "heap_mutex" is held if the heap is shared.
  *
  * Effects:
- *   Find a fit for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found. 
+ *   mm_realloc for the default heap and the tiers in front of it.
  */
 static void *
-find_fit(size_t asize)
+default_realloc(void *ptr, size_t size)
 {
-	struct free_blk *bp;
-
+	void *newptr;
 
-	// Search for the first fit. 
-	 for (bp = free_listp->next; GET_ALLOC(HDRP(bp)) == 0;
-	      bp = ((struct free_blk*)(bp))->next) {
-		// If the size of the current index block is large enough,
-		//return that value
-		if (asize <= (size_t)GET_SIZE(HDRP(bp)))
-			return (bp);
-		if (bp == free_listp) 
-			return NULL;
+	// A block that moves out of the nursery or the spans is allocated
+	// under the lock that the caller already holds.
+	if (IN_NURSERY(ptr))
+		return (nursery_realloc(ptr, size));
+	if (span_owns(ptr))
+		return (span_realloc(ptr, size, default_malloc));
+	if (!lt_enabled)
+		return (mm_heap_realloc(&default_heap, ptr, size));
+	if (ptr == NULL)
+		return (default_malloc(size));
+	if (size == 0) {
+		default_free(ptr);
+		return (NULL);
 	}
 
-	 // No fit was found.
-	return (NULL);
+	// A block that moves ends the lifetime of the old one.
+	lt_clock++;
+	newptr = mm_heap_realloc(lifetime_heap(ptr), ptr, size);
+	if (newptr != NULL && newptr != ptr && lt_count > 0)
+		lifetime_observe(ptr);
+	return (newptr);
 }
 
-/* 
+/*
  * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
+ *   None.
  *
  * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   Turn lifetime-segregated placement on or off.  Takes effect at the
+ *   next call to mm_init.
+ */
+void
+mm_lifetime_enable(int enable)
+{
+
+	lt_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the dense fit index on or off for the heaps created afterwards.
+ *   The default heap follows at the next call to mm_init.
+ */
+void
+mm_fit_index_enable(int enable)
+{
+
+	fit_index_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the page-span tier for requests of SPAN_MINSIZE up to
+ *   SPAN_MAXSIZE bytes on or off.  Takes effect at the next call to
+ *   mm_init.
+ */
+void
+mm_span_enable(int enable)
+{
+
+	span_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn hugepage-aware layout on or off for the heaps created afterwards.
+ *   The default heap follows at the next call to mm_init.
+ */
+void
+mm_hugepage_enable(int enable)
+{
+
+	hugepage_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   No other thread is inside the mm_malloc family.
+ *
+ * Effects:
+ *   Allow or forbid calling the mm_malloc family from several threads at
+ *   once.  While allowed, the default heap is protected by a lock, and
+ *   the next call to mm_init gives it per-class bins for small blocks
+ *   unless the per-CPU caches, the nursery or lifetime segregation are
+ *   in use.
+ */
+void
+mm_threads_enable(int enable)
+{
+
+	threads_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the per-CPU caches of small blocks on or off.  Takes effect at
+ *   the next call to mm_init, and only while the nursery and lifetime
+ *   segregation are off.
+ */
+void
+mm_cpucache_enable(int enable)
+{
+
+	cpucache_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Cap the total capacity of the per-CPU caches at "bytes".
+ */
+void
+mm_cpucache_limit(size_t bytes)
+{
+
+	cpucache_limit(bytes);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Make the maintenance thread empty the per-CPU caches of every CPU
+ *   that has not used them for "idle_us" microseconds.
+ */
+void
+mm_cpucache_idle(unsigned idle_us)
+{
+
+	heap_lock();
+	cpucache_idle = idle_us;
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   "stats" is a valid pointer.
+ *
+ * Effects:
+ *   Copy the sizes and sizing activity of the per-CPU caches since the
+ *   last call to mm_init into "stats".
+ */
+void
+mm_cpucache_stats(struct mm_cpucache_stats *stats)
+{
+
+	cpucache_stats(stats);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the nursery for small requests on or off.  Takes effect at the
+ *   next call to mm_init.
+ */
+void
+mm_nursery_enable(int enable)
+{
+
+	nursery_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   No other thread is inside the mm_malloc family.
+ *
+ * Effects:
+ *   Start the maintenance thread, which wakes every "interval_us"
+ *   microseconds, and clear its statistics.  Returns 0 if the thread was
+ *   started and -1 if it is already running or could not be created.
+ */
+int
+mm_maint_start(unsigned interval_us)
+{
+
+	if (maint_running)
+		return (-1);
+	maint_interval = interval_us;
+	maint_stopping = false;
+	memset(&maint_stats, 0, sizeof(maint_stats));
+	maint_running = true;
+	if (pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+		maint_running = false;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   No other thread is inside the mm_malloc family.
+ *
+ * Effects:
+ *   Stop the maintenance thread, if it is running, and finish its
+ *   outstanding work in the caller.
+ */
+void
+mm_maint_stop(void)
+{
+
+	if (!maint_running)
+		return;
+	pthread_mutex_lock(&heap_mutex);
+	maint_stopping = true;
+	pthread_cond_signal(&maint_wake);
+	pthread_mutex_unlock(&heap_mutex);
+	pthread_join(maint_thread, NULL);
+	maint_work(SIZE_MAX);
+	maint_running = false;
+}
+
+/*
+ * Requires:
+ *   "stats" is a valid pointer.
+ *
+ * Effects:
+ *   Copy the statistics of the maintenance thread since it was last
+ *   started into "stats".
+ */
+void
+mm_maint_stats(struct mm_maint_stats *stats)
+{
+
+	heap_lock();
+	*stats = maint_stats;
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn the counting of requests on or off.  Every call to mm_init
+ *   clears the counts.  Counting is off until this turns it on, since it
+ *   costs about 1 ns per call, over 2% of the fastest calls.
+ */
+void
+mm_stats_enable(int enable)
+{
+
+	stats_enabled = (enable != 0);
+}
+
+/*
+ * Requires:
+ *   "stats" is a valid pointer.
+ *
+ * Effects:
+ *   Copy the counts of requests since the last call to mm_init, and the
+ *   current sizes and free blocks of the heap, into "stats".
+ */
+void
+mm_stats(struct mm_stats *stats)
+{
+
+	heap_lock();
+	stats_collect(stats);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Publish the statistics in a page mapped from the file "path", which
+ *   is created or resized to one page, in place of any page published
+ *   before.  A NULL "path" stops publishing.  Returns 0 if the page was
+ *   published and -1 otherwise.
+ */
+int
+mm_stats_publish(const char *path)
+{
+	struct mm_stats_page *old, *page = NULL;
+	unsigned long seq;
+	int fd;
+
+	if (path != NULL) {
+		// Never truncate the file to zero, since a reader that has
+		// it mapped would fault on the missing page.
+		if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1)
+			return (-1);
+		if (ftruncate(fd, sizeof(*page)) == -1 ||
+		    (page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			close(fd);
+			return (-1);
+		}
+		close(fd);
+
+		// Rewrite the header under the sequence lock, which an old
+		// publisher may have left odd if it died mid-update.
+		seq = page->seq | 1;
+		__atomic_store_n(&page->seq, seq, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		page->magic = MM_STATS_MAGIC;
+		page->version = MM_STATS_VERSION;
+		page->pid = getpid();
+		page->updates = 0;
+		__atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELEASE);
+	}
+
+	heap_lock();
+	old = stats_page;
+	stats_page = page;
+	if (page != NULL)
+		stats_publish();
+	heap_unlock();
+	if (old != NULL)
+		munmap(old, sizeof(*old));
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "overhead" is a valid pointer, and "ptrs" and "sizes" hold "n" blocks
+ *   allocated by mm_malloc or mm_realloc and not freed, or NULL, and the
+ *   sizes that were requested for them.
+ *
+ * Effects:
+ *   Break the bytes of the heap regions down into "overhead".
+ */
+void
+mm_overhead(struct mm_overhead *overhead, void **ptrs, const size_t *sizes,
+    size_t n)
+{
+
+	memset(overhead, 0, sizeof(*overhead));
+	heap_lock();
+	overhead->heap_size = mem_total_heapsize();
+	overhead->other = overhead->heap_size;
+	if (default_heap.heap_listp != NULL) {
+		extend_lock(&default_heap);
+		overhead_heap(&default_heap, overhead, ptrs, sizes, n);
+		extend_unlock(&default_heap);
+	}
+	if (short_heap != NULL)
+		overhead_heap(short_heap, overhead, ptrs, sizes, n);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   "callback" does not call the mm_malloc family or the functions that
+ *   lock the heap.
+ *
+ * Effects:
+ *   Call "callback" with "ctx" for each block of the default and
+ *   short-lived heaps.  See mm.h.
+ */
+void
+mm_heap_walk(mm_walk_t *callback, void *ctx)
+{
+
+	heap_lock();
+	if (default_heap.heap_listp != NULL) {
+		extend_lock(&default_heap);
+		walk_heap(&default_heap, callback, ctx);
+		extend_unlock(&default_heap);
+	}
+	if (short_heap != NULL)
+		walk_heap(short_heap, callback, ctx);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check the default and short-lived heaps for consistency, printing
+ *   every block if "verbose" is set.
+ */
+void
+mm_checkheap(int verbose)
+{
+
+	heap_lock();
+	if (default_heap.heap_listp != NULL) {
+		extend_lock(&default_heap);
+		checkheap(&default_heap, verbose != 0);
+		extend_unlock(&default_heap);
+	}
+	if (short_heap != NULL)
+		checkheap(short_heap, verbose != 0);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   "fd" is open for writing.
+ *
+ * Effects:
+ *   Write a snapshot of the blocks of the default and short-lived heaps to
+ *   "fd".  See mm.h.  Returns 0 if it was written and -1 otherwise.
+ */
+int
+mm_heap_snapshot(int fd)
+{
+	struct mm_snapshot_header *hdr;
+	struct mm_snapshot_heap *sh;
+	struct mm_heap *heaps[2];
+	unsigned long *words, nblocks = 0;
+	unsigned i, n = 0;
+	size_t len;
+	char *buf;
+	int ret;
+
+	heap_lock();
+	if (default_heap.heap_listp != NULL) {
+		extend_lock(&default_heap);
+		heaps[n++] = &default_heap;
+	}
+	if (short_heap != NULL)
+		heaps[n++] = short_heap;
+
+	// Count the blocks, and copy their headers into a mapping of that
+	// size, so that the heaps stay locked only while memory is copied.
+	for (i = 0; i < n; i++)
+		nblocks += snapshot_heap(heaps[i], NULL, NULL);
+	len = sizeof(*hdr) + n * sizeof(*sh) + nblocks * sizeof(*words);
+	if ((buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+	    MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+		hdr = (struct mm_snapshot_header *)buf;
+		hdr->magic = MM_SNAPSHOT_MAGIC;
+		hdr->version = MM_SNAPSHOT_VERSION;
+		hdr->heaps = n;
+		hdr->word_size = sizeof(*words);
+		sh = (struct mm_snapshot_heap *)(hdr + 1);
+		for (i = 0; i < n; i++) {
+			words = (unsigned long *)(sh + 1);
+			sh = (struct mm_snapshot_heap *)(words +
+			    snapshot_heap(heaps[i], sh, words));
+		}
+	}
+	if (default_heap.heap_listp != NULL)
+		extend_unlock(&default_heap);
+	heap_unlock();
+
+	if (buf == MAP_FAILED)
+		return (-1);
+	ret = write_all(fd, buf, len);
+	munmap(buf, len);
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of a block allocated by mm_malloc or mm_realloc.
+ *
+ * Effects:
+ *   Returns 1 if "ptr" was placed in the short-lived heap and 0 otherwise.
+ */
+int
+mm_lifetime_predicted_short(void *ptr)
+{
+
+	return (short_heap != NULL && lifetime_heap(ptr) == short_heap);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create a new heap in its own region of at most "maxsize" bytes, or of
+ *   MAX_HEAP bytes if "maxsize" is zero.  Returns the new heap if it was
+ *   successfully created and NULL otherwise.
+ */
+mm_heap_t *
+mm_heap_create(size_t maxsize)
+{
+	mem_region_t *region;
+	struct mm_heap *heap;
+
+	if ((region = mem_region_create(maxsize != 0 ? maxsize : MAX_HEAP)) ==
+	    NULL)
+		return (NULL);
+
+	// The heap's own state lives at the bottom of its region.
+	if ((heap = mem_region_sbrk(region,
+	    ROUND(sizeof(struct mm_heap)))) == (void *)-1) {
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	heap->region = region;
+	heap->index = NULL;
+	if (fit_index_enabled && (heap->index = index_create(heap,
+	    maxsize != 0 ? maxsize : MAX_HEAP)) == NULL) {
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	if (heap_init(heap) == -1) {
+		if (heap->index != NULL)
+			mem_region_destroy(heap->index->region);
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	return (heap);
+}
+
+/*
+ * Requires:
+ *   "heap" was returned by mm_heap_create and has not been destroyed.
+ *
+ * Effects:
+ *   Destroy "heap", releasing all of its memory at once.  Every block that
+ *   was allocated from "heap" becomes invalid.
+ */
+void
+mm_heap_destroy(mm_heap_t *heap)
+{
+
+	if (heap->index != NULL)
+		mem_region_destroy(heap->index->region);
+	// The heap struct is inside the region, so this frees it as well.
+	mem_region_destroy(heap->region);
+}
+
+/* 
+ * Requires:
+ *   "heap" is a valid heap.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload from "heap",
+ *   unless "size" is zero.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+void *
+mm_heap_malloc(mm_heap_t *heap, size_t size) 
+{
+	size_t asize;      // Adjusted block size
+	size_t extendsize; // Amount to extend heap if no fit
+	void *bp;
+
+	// Ignore spurious requests, and those that adjust_size would wrap.
+	if (size <= 0 || size > SIZE_MAX - 2 * DSIZE)
+		return (NULL);
+
+	// Adjust block size to include overhead and alignment reqs.
+	asize = adjust_size(size);
+
+	// Search the free list for a fit.
+	if ((bp = find_fit(heap, asize)) != NULL) {
+		place(heap, bp, asize);
+		return (bp);
+	}
+
+	// Coalesce the deferred frees before growing the default heap.
+	if (heap == &default_heap && maint_deferred != NULL) {
+		maint_stats.drained += drain_deferred(SIZE_MAX);
+		if ((bp = find_fit(heap, asize)) != NULL) {
+			place(heap, bp, asize);
+			return (bp);
+		}
+	}
+
+	// No fit found.  Get more memory and place the block.  A free
+	// wilderness is coalesced with the extension, so grow the heap by
+	// exactly the part of the request that it cannot cover.
+	extend_lock(heap);
+	if ((bp = wilderness(heap)) != NULL)
+		extendsize = asize - GET_SIZE(HDRP(bp));
+	else
+		extendsize = MAX(asize, CHUNKSIZE);
+	bp = extend_heap(heap, extendsize / WSIZE);
+	extend_unlock(heap);
+
+	// Coalesce the binned blocks only once the default heap is full.
+	if (bp == NULL && heap == &default_heap && bins_active &&
+	    bin_flush() > 0) {
+		if (maint_deferred != NULL)
+			maint_stats.drained += drain_deferred(SIZE_MAX);
+		bp = find_fit(heap, asize);
+	}
+	if (bp == NULL)
+		return (NULL);
+	place(heap, bp, asize);
+
+	// Publish the statistics when the default heap grows, unless they
+	// were published just before.
+	if (heap == &default_heap && stats_page != NULL && stats_due())
+		stats_publish();
+	return (bp);
+} 
+
+/* 
+ * Requires:
+ *   "heap" is a valid heap and "bp" is either the address of an allocated
+ *   block of "heap" or NULL.
+ *
+ * Effects:
+ *   Free a block.
+ */
+void
+mm_heap_free(mm_heap_t *heap, void *bp)
+{
+	size_t size;
+
+	// Ignore spurious requests.
+	if (bp == NULL)
+		return;
+
+	// Free and coalesce the block.
+	size = GET_SIZE(HDRP(bp));
+	PUT(HDRP(bp), PACK(size, 0));
+	PUT(FTRP(bp), PACK(size, 0));
+	coalesce(heap, bp);
+}
+
+/*
+ * Requires:
+ *   "heap" is a valid heap and "ptr" is either the address of an allocated
+ *   block of "heap" or NULL.
+ *
+ * Effects:
+ *   Reallocates the block "ptr" to a block with at least "size" bytes of
+ *   payload, unless "size" is zero.  If "size" is zero, frees the block
+ *   "ptr" and returns NULL.  If the block "ptr" is already a block with at
+ *   least "size" bytes of payload, then "ptr" may optionally be returned.
+ *   Otherwise, a new block is allocated and the contents of the old block
+ *   "ptr" are copied to that new block.  Returns the address of this new
+ *   block if the allocation was successful and NULL otherwise.
+ */
+void *
+mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size) 
+{
+	size_t asize;
+	size_t esize;
+	size_t oldsize;
+	void *newptr;
+
+	// If size == 0 then this is just free, and return NULL. 
+	if (size == 0) {
+		mm_heap_free(heap, ptr);
+		return (NULL);
+
+		// We need to see whether or not we have enough space to
+		// reallocate.
+	} else if (ptr == NULL) {
+		return (mm_heap_malloc(heap, size));
+	} else if (size > SIZE_MAX - 2 * DSIZE)
+		return (NULL);
+
+	// This is the  amount of space our current block has.
+	oldsize = GET_SIZE(HDRP(ptr));
+	asize = adjust_size(size);
+		
+	// Our current block has at least the minimum amount of space.
+	if (asize <= oldsize)
+		return (ptr);
+
+	// The next block is free and has enough space to extend to.  Like
+	// place, split off the rest of it if that is at least the minimum
+	// block size, so that growing into the wilderness does not take all
+	// of it.
+	esize = oldsize + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+	if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr))) && esize >= asize) {
+		remove_free(heap, (struct free_blk*)NEXT_BLKP(ptr));
+		if (esize - asize >= 3 * DSIZE) {
+			PUT(HDRP(ptr), PACK(asize, 1));
+			PUT(FTRP(ptr), PACK(asize, 1));
+			newptr = NEXT_BLKP(ptr);
+			PUT(HDRP(newptr), PACK(esize - asize, 0));
+			PUT(FTRP(newptr), PACK(esize - asize, 0));
+			add_free(heap, (struct free_blk*)newptr);
+		} else {
+			PUT(HDRP(ptr), PACK(esize, 1));
+			PUT(FTRP(ptr), PACK(esize, 1));
+		}
+		return (ptr);
+	}
+
+	// The next block does not have enough space to account for our
+	// requested space.  We must malloc a different memory block and copy
+	// the old payload into it.
+	if ((newptr = mm_heap_malloc(heap, size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, oldsize - DSIZE);
+	mm_heap_free(heap, ptr);
+	return (newptr);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/* 
+ * Requires:
+ *   "heap->region" is an empty region, apart from any bytes reserved for
+ *   the heap struct itself.
+ *
+ * Effects:
+ *   Initialize "heap".  Returns 0 if the heap was successfully initialized
+ *   and -1 otherwise.
+ */
+static int
+heap_init(struct mm_heap *heap)
+{
+	char *heap_listp;
+	struct free_blk *free_listp;
+
+	// Create the initial empty heap.
+	if ((heap_listp = mem_region_sbrk(heap->region, 8 * WSIZE)) ==
+	    (void *)-1)
+		return (-1);
+
+	free_listp = (struct free_blk*) (heap_listp + (4 * WSIZE));
+
+	PUT(heap_listp, 0);                            // Alignment padding.
+	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); // Prologue header. 
+	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); // Prologue footer.
+
+	PUT(heap_listp + (3 * WSIZE), PACK((4 * WSIZE), 1)); // Dummy head
+	                                                     // header.
+	PUT(heap_listp + (4 * WSIZE), (size_t) free_listp); // Dummy head
+	                                                    // prev.
+	PUT(heap_listp + (5 * WSIZE), (size_t) free_listp);// Dummy head next
+	PUT(heap_listp + (6 * WSIZE), PACK((4 * WSIZE), 1)); // Dummy head 
+  	                                                     // footer.	
+	PUT(heap_listp + (7 * WSIZE), PACK(0, 1));     // Epilogue header.
+	heap_listp += (2 * WSIZE);
+
+	heap->heap_listp = heap_listp;
+	heap->free_listp = free_listp;
+	heap->heap_end = heap_listp + 6 * WSIZE;
+
+	// Extend the empty heap with a free block of CHUNKSIZE bytes.
+	if (extend_heap(heap, CHUNKSIZE / WSIZE) == NULL)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "size" is greater than zero.
+ *
+ * Effects:
+ *   Returns the size of the block needed for a payload of "size" bytes,
+ *   including overhead and alignment.
+ */
+static size_t
+adjust_size(size_t size)
+{
+	size_t asize;
+
+	if (size <= DSIZE)
+		asize = 2 * DSIZE;
+	else
+		asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+	// Harded coded cases to drastically improve throughput.
+	if (size == 448)
+		asize = 528;
+	if (size == 112)
+		asize = 144;
+	return (asize);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing.  Returns the address of the coalesced
+ *   block.
+ */
+static void *
+coalesce(struct mm_heap *heap, void *bp) 
+{
+	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+	size_t size = GET_SIZE(HDRP(bp));
+	char *lo = bp, *hi = (char *)bp + size;
+
+	
+	// The previous and next blocks are occupied and can't be combined.
+	if (prev_alloc && next_alloc) {                 /* Case 1 */
+		add_free(heap, (struct free_blk*) bp);
+		if (hugepage_enabled)
+			release_hugepages(heap, bp, lo, hi);
+		return (bp);
+
+	// The next block is free and can be combined with the current block.
+	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
+		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+		// Remove the next block from the free list.
+		remove_free(heap, (struct free_blk*) NEXT_BLKP(bp));
+		PUT(HDRP(bp), PACK(size, 0));
+		PUT(FTRP(bp), PACK(size, 0));
+
+        // The prev block is free and can be combined with the current block.
+	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
+		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+		// Shift the pointer to represent the combined start address.
+	 	bp = PREV_BLKP(bp);
+		// Remove the prev block from the free list.
+		remove_free(heap, (struct free_blk*) bp);
+		PUT(HDRP(bp), PACK(size, 0));
+		PUT(FTRP(bp), PACK(size, 0));
+
+	// Both blocks are free and can be combined with the current block.
+	} else {                                        /* Case 4 */
+		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
+		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
+		// Remove the previous block from the free list.
+		remove_free(heap, (struct free_blk*) PREV_BLKP(bp));
+		// Remove the next block from the free list.
+		remove_free(heap, (struct free_blk*) NEXT_BLKP(bp));
+		bp = PREV_BLKP(bp);
+		PUT(HDRP(bp), PACK(size, 0));
+		PUT(FTRP(bp), PACK(size, 0));
+	}
+	TRACE_FLAG(MM_TRACE_COALESCED);
+	PROBE2(coalesce, bp, size);
+	// Add the correct block of memory to the free list.
+	add_free(heap, (struct free_blk*) bp);
+	if (hugepage_enabled)
+		release_hugepages(heap, bp, lo, hi);
+	return (bp);
+}
+
+/* 
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Extend the heap with a free block and return that block's address.
+ */
+static void *
+extend_heap(struct mm_heap *heap, size_t words) 
+{
+	size_t size;
+	void *bp;
+		
+
+	// Allocate an even number of words to maintain alignment. 
+	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+	if ((bp = mem_region_sbrk(heap->region, size)) == (void *)-1)  
+		return (NULL);
+	if (stats_enabled)
+		stats_add(stats_shard(), STATS_SBRKS, 1);
+	TRACE_FLAG(MM_TRACE_EXTENDED);
+	PROBE2(extend_heap, bp, size);
+
+	// Initialize free block header/footer and the epilogue header. 
+	PUT(HDRP(bp), PACK(size, 0));         // Free block header 
+	PUT(FTRP(bp), PACK(size, 0));         // Free block footer 
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // New epilogue header 
+	heap->heap_end = (char *)bp + size;
+
+	// Coalesce if the previous block was free.
+	return (coalesce(heap, bp));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Find a fit for a block with "asize" bytes.  Returns that block's address
+ *   or NULL if no suitable block was found.  The wilderness is only chosen
+ *   when no other free block fits, so that it stays intact for growth.
+ *   With hugepage-aware layout, a fit that would touch a released hugepage
+ *   is only chosen when no fit within partially used hugepages exists.
+ */
+static void *
+find_fit(struct mm_heap *heap, size_t asize)
+{
+	struct free_blk *bp;
+	void *fresh = NULL, *wild = wilderness(heap);
+
+	if (heap->index != NULL)
+		return (index_fit(heap->index, asize, wild));
+
+	// Search for the first fit, passing over the wilderness.
+	for (bp = heap->free_listp->next; bp != heap->free_listp;
+	     bp = ((struct free_blk*)(bp))->next) {
+		TRACE_VISIT();
+		if ((void *)bp == wild)
+			continue;
+		// If the size of the current index block is large enough,
+		//return that value
+		if (asize <= (size_t)GET_SIZE(HDRP(bp))) {
+			if (!hugepage_enabled || !touches_released(bp, asize))
+				return (bp);
+			if (fresh == NULL)
+				fresh = bp;
+		}
+	}
+
+	// Only carve up the wilderness when no other block fits.
+	PROBE2(find_fit_slow, asize, heap->heap_listp);
+	if (wild != NULL && asize <= (size_t)GET_SIZE(HDRP(wild)) &&
+	    (fresh == NULL || !touches_released(wild, asize)))
+		return (wild);
+
+	// No fit was found, or only fits in released hugepages.
+	return (fresh);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the address of the "wilderness", the free block bordering the
+ *   epilogue, or NULL if the last block of the heap is allocated.
+ */
+static void *
+wilderness(struct mm_heap *heap)
+{
+	// The epilogue header is the last word of the heap.  The maintenance
+	// thread may call this while mdriver resets the brk, so the end of
+	// the heap is kept in the heap itself.  heap_carve stores it after
+	// the tags of the blocks that it carves, so this sees either the old
+	// last block or a complete carved one.
+	void *bp = PREV_BLKP(__atomic_load_n(&heap->heap_end,
+	    __ATOMIC_ACQUIRE));
+
+	return (GET_ALLOC(HDRP(bp)) ? NULL : bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes,
+ *   and hugepage-aware layout is on.
+ *
+ * Effects:
+ *   Returns true if placing "asize" bytes at the start of "bp" would touch
+ *   one of the hugepages that "bp" has released.  A free block releases
+ *   the whole hugepages between the first two words of its payload and
+ *   its footer, which are the only words of it that are written, once
+ *   there are at least HP_RELEASE bytes of them.
+ */
+static bool
+touches_released(void *bp, size_t asize)
+{
+	uintptr_t first = HP_UP((char *)bp + DSIZE);
+	uintptr_t last = HP_DOWN((char *)bp + GET_SIZE(HDRP(bp)) - DSIZE);
+
+	return (last >= first + HP_RELEASE &&
+	    first < (uintptr_t)bp - WSIZE + asize);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that was just coalesced from a
+ *   newly freed range ["lo", "hi") and its free neighbors.
+ *
+ * Effects:
+ *   Release the whole hugepages inside "bp" once it has HP_RELEASE bytes
+ *   of them, unless it had as many before the range was freed or it is
+ *   the wilderness, whose hugepages the next heap extension reuses.  A new
+ *   whole hugepage must reach within DSIZE bytes of the freed range, so
+ *   none is released when none does.  Returns memory to the OS only in
+ *   whole hugepages, so that the hugepages in use are never split.  While
+ *   the maintenance thread runs, the block is queued for it instead.
+ */
+static void
+release_hugepages(struct mm_heap *heap, void *bp, char *lo, char *hi)
+{
+	uintptr_t first = HP_UP((char *)bp + DSIZE);
+	uintptr_t last = HP_DOWN((char *)bp + GET_SIZE(HDRP(bp)) - DSIZE);
+
+	if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 ||
+	    last < first + HP_RELEASE)
+		return;
+
+	// Leave the release to the maintenance thread while it runs.  A
+	// block merged into a queued candidate can hide it, so queue every
+	// large enough block, and sweep the heap if the queue overflows.
+	// remove_free takes a block off the queue when it leaves the free
+	// list, so every queued block is free.
+	if (maint_running && heap == &default_heap) {
+		if (maint_npurges < MAINT_PURGES)
+			maint_purges[maint_npurges++] = bp;
+		else
+			maint_sweep = true;
+		return;
+	}
+	if (MAX(first, HP_DOWN(lo - DSIZE)) >= MIN(last, HP_UP(hi + DSIZE)))
+		return;
+	mem_region_release(heap->region, (void *)first, last - first);
+}
+
+/* 
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes at the start of the free block "bp" and
+ *   split that block if the remainder would be at least the minimum block
+ *   size. 
+ */
+static void
+place(struct mm_heap *heap, void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));   
+
+	// Remove the block while its header still holds its free size.
+	remove_free(heap, (struct free_blk*)bp);
+	if ((csize - asize) >= (3 * DSIZE)) { 
+		PUT(HDRP(bp), PACK(asize, 1));
+		PUT(FTRP(bp), PACK(asize, 1));
+		bp = NEXT_BLKP(bp);
+		PUT(HDRP(bp), PACK(csize - asize, 0));
+		PUT(FTRP(bp), PACK(csize - asize, 0));
+		add_free(heap, (struct free_blk*)bp);
+	} else {
+		PUT(HDRP(bp), PACK(csize, 1));
+		PUT(FTRP(bp), PACK(csize, 1));
+	}
+}
+
+/*
+ * Requires: 
+ *     "bp" is the address of a block not already stored in the free list.
+ *
+ * Effects:
+ *     Adds the block of memory from the free list, or to the fit index if
+ *     the heap has one.
+ */
+static void
+add_free(struct mm_heap *heap, struct free_blk *bp)
+{
+	struct fit_index *index = heap->index;
+	struct fit_class *fc;
+	unsigned c;
+
+	if (index != NULL) {
+		c = index_class(GET_SIZE(HDRP(bp)));
+		fc = &index->classes[c];
+		if (fc->count == fc->cap)
+			index_grow(index, c);
+		fc->sizes[fc->count] = GET_SIZE(HDRP(bp)) / DSIZE;
+		fc->offsets[fc->count] = ((char *)bp - index->base) / DSIZE;
+		PUT(bp, fc->count);
+		fc->count++;
+		index->nonempty |= 1U << c;
+		return;
+	}
+	((struct free_blk*) (heap->free_listp->next))->prev = bp;
+	bp->next = heap->free_listp->next;
+	bp->prev = heap->free_listp;
+	heap->free_listp->next = bp;
+}
+
+/*
+ * Requires: 
+ *     "bp" is the address of a block already stored in the free list, or
+ *     in the fit index if the heap has one, whose header still holds the
+ *     size it had when it was added.
+ *
+ * Effects:
+ *     Removes the block of memory from the free list or the fit index.
+ */
+static void
+remove_free(struct mm_heap *heap, struct free_blk *bp)
+{
+	struct fit_index *index = heap->index;
+	struct fit_class *fc;
+	size_t last, slot;
+	unsigned c;
+
+	// A block that is allocated or merged must not be purged.
+	if (maint_npurges > 0 && heap == &default_heap)
+		purge_cancel(bp);
+
+	if (index != NULL) {
+		// Move the last entry of the class into the vacated slot.
+		c = index_class(GET_SIZE(HDRP(bp)));
+		fc = &index->classes[c];
+		slot = GET(bp);
+		last = --fc->count;
+		if (slot != last) {
+			fc->sizes[slot] = fc->sizes[last];
+			fc->offsets[slot] = fc->offsets[last];
+			PUT(index->base + (size_t)fc->offsets[slot] * DSIZE,
+			    slot);
+		}
+		if (fc->count == 0)
+			index->nonempty &= ~(1U << c);
+		return;
+	}
+	((struct free_blk*) (bp->next))->prev = bp->prev;
+	((struct free_blk*) (bp->prev))->next = bp->next;
+	
+}
+
+/*
+ * Requires:
+ *   "heap->region" has been set, and "maxsize" is the most bytes that it
+ *   can hold.
+ *
+ * Effects:
+ *   Create an empty fit index for "heap" in its own region.  Returns the
+ *   new index if it was successfully created and NULL otherwise.
+ */
+static struct fit_index *
+index_create(struct mm_heap *heap, size_t maxsize)
+{
+	struct fit_index *index;
+	mem_region_t *region;
+	size_t size, total = 0;
+	uint32_t *p;
+	unsigned c;
+
+	// A heap of maxsize bytes has at most maxsize / 2^(c+5) blocks in
+	// class c, and index_grow at most doubles that.  Reserve room for
+	// the arrays of every class at their largest, so that growing the
+	// region cannot fail.
+	for (c = 0; c < FIT_CLASSES; c++)
+		total += 2 * MAX(2 * ((maxsize >> (c + 5)) + 1), FIT_MINCAP);
+	size = ROUND(sizeof(struct fit_index)) + total * sizeof(uint32_t);
+	if ((region = mem_region_create(size)) == NULL)
+		return (NULL);
+#ifdef MADV_NOHUGEPAGE
+	// The arrays rarely reach their reserved size, so keep them out of
+	// the hugepages that memlib asks for, which the first touch would
+	// otherwise fault in and zero whole.
+	madvise(mem_region_lo(region), size, MADV_NOHUGEPAGE);
+#endif
+
+	// Like the heap struct, the index lives at the bottom of its region.
+	if ((index = mem_region_sbrk(region,
+	    ROUND(sizeof(struct fit_index)))) == (void *)-1) {
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	index->region = region;
+	index->base = mem_region_lo(heap->region);
+	index->nonempty = 0;
+	p = (uint32_t *)((char *)index + ROUND(sizeof(struct fit_index)));
+	for (c = 0; c < FIT_CLASSES; c++) {
+		index->classes[c].sizes = p;
+		index->classes[c].offsets = p;
+		index->classes[c].count = 0;
+		index->classes[c].cap = 0;
+	}
+	return (index);
+}
+
+/*
+ * Requires:
+ *   Class "c" of "index" is full.
+ *
+ * Effects:
+ *   Double the arrays of class "c", or give it FIT_MINCAP entries if it
+ *   has none.  The region is sbrk'd by the added entries, and the arrays
+ *   of class "c" and the later classes move up to make room.  Slots are
+ *   positions within a class, so the free blocks need no update.
+ */
+static void
+index_grow(struct fit_index *index, unsigned c)
+{
+	struct fit_class *fc = &index->classes[c];
+	uint32_t *end, *later;
+	size_t delta;
+	unsigned i;
+
+	delta = MAX(fc->cap, FIT_MINCAP / 2) * 2 - fc->cap;
+
+	// index_create reserved enough room for this to succeed.
+	end = mem_region_sbrk(index->region, 2 * delta * sizeof(uint32_t));
+	later = fc->offsets + fc->cap;
+	memmove(later + 2 * delta, later, (char *)end - (char *)later);
+	memmove(fc->offsets + delta, fc->offsets,
+	    fc->count * sizeof(uint32_t));
+	fc->offsets += delta;
+	fc->cap += delta;
+	for (i = c + 1; i < FIT_CLASSES; i++) {
+		index->classes[i].sizes += 2 * delta;
+		index->classes[i].offsets += 2 * delta;
+	}
+}
+
+/*
+ * Requires:
+ *   "size" is at least the minimum block size.
+ *
+ * Effects:
+ *   Returns the fit index class of a block of "size" bytes.
+ */
+static unsigned
+index_class(size_t size)
+{
+	unsigned c = (sizeof(long) * 8 - 1) - __builtin_clzl(size) - 5;
+
+	return (c < FIT_CLASSES ? c : FIT_CLASSES - 1);
+}
+
+/*
+ * Requires:
+ *   "wild" is the wilderness block of the index's heap or NULL.
+ *
+ * Effects:
+ *   Find a fit for a block with "asize" bytes in "index", searching the
+ *   class of "asize" and then the larger nonempty classes.  Like the list
+ *   search, the wilderness is only chosen when no other free block fits.
+ *   Returns that block's address or NULL if no suitable block was found.
+ */
+static void *
+index_fit(struct fit_index *index, size_t asize, void *wild)
+{
+	struct fit_class *fc;
+	uint32_t need = asize / DSIZE, skip = UINT32_MAX;
+	unsigned c, first = index_class(asize), mask;
+	size_t i;
+
+	if (wild != NULL)
+		skip = ((char *)wild - index->base) / DSIZE;
+
+	// Visit the nonempty classes from the class of asize upward.  Every
+	// block in a larger class fits, so the scan of a larger class stops
+	// at its first entry that is not the wilderness.
+	for (mask = index->nonempty & ~((1U << first) - 1); mask != 0;
+	     mask &= mask - 1) {
+		c = __builtin_ctz(mask);
+		fc = &index->classes[c];
+		TRACE_VISIT();
+		for (i = 0; (i = index_scan(fc->sizes, i, fc->count, need)) <
+		    fc->count; i++)
+			if (fc->offsets[i] != skip)
+				return (index->base +
+				    (size_t)fc->offsets[i] * DSIZE);
+	}
+
+	// Only carve up the wilderness when no other block fits.
+	PROBE2(find_fit_slow, asize, index->base);
+	if (wild != NULL && asize <= (size_t)GET_SIZE(HDRP(wild)))
+		return (wild);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "i" is at most "n".
+ *
+ * Effects:
+ *   Returns the first index in ["i", "n") whose entry in "sizes" is at
+ *   least "need", or "n" if there is none.  The sizes are compared eight
+ *   at a time with AVX2 when compiled with -mavx2 and four at a time with
+ *   SSE2 otherwise.
+ */
+static size_t
+index_scan(const uint32_t *sizes, size_t i, size_t n, uint32_t need)
+{
+#if defined(__AVX2__)
+	__m256i v, lim = _mm256_set1_epi32((int)need - 1);
+	int m;
+
+	for (; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)&sizes[i]);
+		m = _mm256_movemask_ps(_mm256_castsi256_ps(
+		    _mm256_cmpgt_epi32(v, lim)));
+		if (m != 0)
+			return (i + __builtin_ctz(m));
+	}
+#elif defined(__SSE2__)
+	__m128i v, lim = _mm_set1_epi32((int)need - 1);
+	int m;
+
+	for (; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)&sizes[i]);
+		m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, lim)));
+		if (m != 0)
+			return (i + __builtin_ctz(m));
+	}
+#endif
+	for (; i < n; i++)
+		if (sizes[i] >= need)
+			break;
+	return (i);
+}
+
+/*
+ * Requires:
+ *   "size" is greater than zero.
+ *
+ * Effects:
+ *   Returns the lifetime class of a request for "size" bytes.
+ */
+static unsigned
+lifetime_class(size_t size)
+{
+	unsigned cls = 0;
+
+	while ((size >>= 1) != 0 && cls < LT_CLASSES - 1)
+		cls++;
+	return (cls);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   Returns the heap that holds "bp".
+ */
+static struct mm_heap *
+lifetime_heap(void *bp)
+{
+
+	// The short-lived heap's struct is at the bottom of its region.
+	if (short_heap != NULL && (char *)bp > (char *)short_heap &&
+	    (char *)bp <= (char *)mem_region_hi(short_heap->region))
+		return (short_heap);
+	return (&default_heap);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly allocated block of lifetime class
+ *   "cls".
+ *
+ * Effects:
+ *   Record "bp" and the current allocation clock in the sample table,
+ *   unless the table is too full to probe quickly.
+ */
+static void
+lifetime_sample(void *bp, unsigned cls)
+{
+	unsigned i;
+
+	if (lt_count >= LT_TABLESIZE / 4 * 3)
+		return;
+	for (i = LT_HASH(bp); lt_table[i].bp != NULL;
+	     i = (i + 1) % LT_TABLESIZE)
+		;
+	lt_table[i].bp = bp;
+	lt_table[i].birth = lt_clock;
+	lt_table[i].cls = cls;
+	lt_count++;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block that is being freed.
+ *
+ * Effects:
+ *   If "bp" was sampled, fold its lifetime into its class's average and
+ *   remove it from the sample table.
+ */
+static void
+lifetime_observe(void *bp)
+{
+	struct lt_class *lc;
+	size_t life;
+	unsigned i, j, home;
+
+	for (i = LT_HASH(bp); lt_table[i].bp != bp;
+	     i = (i + 1) % LT_TABLESIZE)
+		if (lt_table[i].bp == NULL)
+			return;
+
+	// Update the moving average, weighting the new sample by 1/8.
+	life = lt_clock - lt_table[i].birth;
+	lc = &lt_classes[lt_table[i].cls];
+	if (lc->samples == 0)
+		lc->avg = life;
+	else
+		lc->avg = lc->avg - lc->avg / 8 + life / 8;
+	if (lc->samples < LT_MINSAMPLES)
+		lc->samples++;
+
+	// Delete the slot, shifting back later entries of the same probe run.
+	for (j = (i + 1) % LT_TABLESIZE; lt_table[j].bp != NULL;
+	     j = (j + 1) % LT_TABLESIZE) {
+		home = LT_HASH(lt_table[j].bp);
+		if ((j > i && (home <= i || home > j)) ||
+		    (j < i && (home <= i && home > j))) {
+			lt_table[i] = lt_table[j];
+			i = j;
+		}
+	}
+	lt_table[i].bp = NULL;
+	lt_count--;
+}
+
+/*
+ * Requires:
+ *   The nursery is on and "size" is between 1 and NURSERY_MAXSIZE.
+ *
+ * Effects:
+ *   Allocate an object with at least "size" bytes of payload from the
+ *   nursery.  Returns the address of the object or NULL if the nursery
+ *   has no page left.
+ */
+static void *
+nursery_malloc(size_t size)
+{
+	size_t bsize = ROUND(size + WSIZE);
+	char *hdr;
+
+	if (bsize > (size_t)(nursery_limit - nursery_bump) &&
+	    !nursery_next_page())
+		return (NULL);
+
+	// Bump the pointer, leaving the payload doubleword aligned.
+	hdr = nursery_bump;
+	nursery_bump += bsize;
+	nursery_live[nursery_page]++;
+	PUT(hdr, bsize);
+	return (hdr + WSIZE);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a live nursery object.
+ *
+ * Effects:
+ *   Free the object "bp".  When that was the last live object of its
+ *   page, the page is recycled: the current page is reused from its start
+ *   and any other page becomes available to nursery_next_page.
+ */
+static void
+nursery_free_block(void *bp)
+{
+	unsigned page = ((char *)bp - nursery_base) / NURSERY_PAGESIZE;
+
+	if (--nursery_live[page] != 0)
+		return;
+	if (page == nursery_page)
+		nursery_bump = nursery_base + page * NURSERY_PAGESIZE + WSIZE;
+	else
+		nursery_free[nursery_nfree++] = page;
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and "ptr" is the address
+ *   of a live nursery object.
+ *
+ * Effects:
+ *   Reallocates the nursery object "ptr".  See mm_heap_realloc.
+ */
+static void *
+nursery_realloc(void *ptr, size_t size)
+{
+	size_t oldsize = GET(HDRP(ptr)) - WSIZE;
+	void *newptr;
+
+	if (size == 0) {
+		nursery_free_block(ptr);
+		return (NULL);
+	}
+
+	// The object's slot may already be large enough.
+	if (size <= oldsize)
+		return (ptr);
+	if ((newptr = default_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, oldsize);
+	nursery_free_block(ptr);
+	return (newptr);
+}
+
+/*
+ * Requires:
+ *   The nursery is on.
+ *
+ * Effects:
+ *   Make a recycled page, or failing that a fresh one, the current page.
+ *   Returns false if the nursery has no page left.
+ */
+static bool
+nursery_next_page(void)
+{
+	unsigned page;
+
+	if (nursery_nfree > 0)
+		page = nursery_free[--nursery_nfree];
+	else if (nursery_npages < NURSERY_PAGES &&
+	    mem_region_sbrk(nursery, NURSERY_PAGESIZE) != (void *)-1) {
+		page = nursery_npages++;
+		nursery_extent += NURSERY_PAGESIZE;
+		if (stats_enabled)
+			stats_add(stats_shard(), STATS_SBRKS, 1);
+		TRACE_FLAG(MM_TRACE_EXTENDED);
+	} else
+		return (false);
+
+	// The page being left holds live objects, so it is not recycled
+	// until they are freed.
+	nursery_page = page;
+	nursery_bump = nursery_base + page * NURSERY_PAGESIZE + WSIZE;
+	nursery_limit = nursery_base + (page + 1) * NURSERY_PAGESIZE;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "cls" is a class of the per-CPU caches.
+ *
+ * Effects:
+ *   Take a batch of blocks of class "cls" from the transfer cache, and
+ *   push all but the first onto the current CPU's cache.  Returns the
+ *   first block, or NULL if the transfer cache is empty.
+ */
+static void *
+cpucache_fill(unsigned cls)
+{
+	void *blocks[CPUCACHE_BATCH_MAX];
+	unsigned i, n;
+
+	if ((n = cpucache_transfer_remove(cls, blocks)) == 0)
+		return (NULL);
+	for (i = 1; i < n; i++) {
+		// Another thread may have filled this CPU's cache meanwhile.
+		if (cpucache_push(cls, blocks[i]) != 0) {
+			cpucache_release(cls, &blocks[i], n - i);
+			break;
+		}
+	}
+	return (blocks[0]);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and "size" is a request
+ *   served by the per-CPU caches.
+ *
+ * Effects:
+ *   Allocate a block for "size" bytes from the default heap, and up to a
+ *   batch of blocks of the same size for the current CPU's cache.
+ *   Returns the first block, or NULL if the allocation failed.
+ */
+static void *
+cpucache_refill(size_t size)
+{
+	size_t csize;
+	void *bp, *first;
+	unsigned i, n;
+
+	if ((first = mm_heap_malloc(&default_heap, size)) == NULL)
+		return (NULL);
+	n = cpucache_batch(CPUCACHE_CLASS(adjust_size(size)));
+	for (i = 1; i < n; i++) {
+		if ((bp = mm_heap_malloc(&default_heap, size)) == NULL)
+			break;
+
+		// An unsplit block can be larger than its request.
+		csize = GET_SIZE(HDRP(bp));
+		if (csize > CPUCACHE_MAXBLOCK ||
+		    cpucache_push(CPUCACHE_CLASS(csize), bp) != 0) {
+			mm_heap_free(&default_heap, bp);
+			break;
+		}
+	}
+	return (first);
+}
+
+/*
+ * Requires:
+ *   "cls" is a class of the per-CPU caches, "bp" is a free block of that
+ *   class that is not cached, and the current CPU's cache of that class
+ *   was full.
+ *
+ * Effects:
+ *   Move "bp" and up to a batch less one of the current CPU's cached
+ *   blocks of class "cls" to the transfer cache, or to the heap if the
+ *   transfer cache is full.
+ */
+static void
+cpucache_spill(unsigned cls, void *bp)
+{
+	void *blocks[CPUCACHE_BATCH_MAX];
+	unsigned n, want = cpucache_batch(cls);
+
+	blocks[0] = bp;
+	for (n = 1; n < want; n++) {
+		if ((blocks[n] = cpucache_pop(cls)) == NULL)
+			break;
+	}
+	cpucache_release(cls, blocks, n);
+}
+
+/*
+ * Requires:
+ *   "cls" is a class of the per-CPU caches, and "blocks" holds "n" free
+ *   blocks of that class that are not cached, where "n" is at most a
+ *   batch.
+ *
+ * Effects:
+ *   Move the blocks to the transfer cache of class "cls", or free them to
+ *   the default heap under the lock if the transfer cache is full.
+ */
+static void
+cpucache_release(unsigned cls, void **blocks, unsigned n)
+{
+	unsigned i;
+
+	if (cpucache_transfer_insert(cls, blocks, n) == 0)
+		return;
+	heap_lock();
+	for (i = 0; i < n; i++)
+		default_free(blocks[i]);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   "size" is a request whose block, of "asize" bytes, is binned.
+ *
+ * Effects:
+ *   Allocate a block for "size" bytes from the bin of class "asize",
+ *   refilling the bin with a batch of blocks when it is empty.  Returns
+ *   the block, or NULL if the allocation failed.
+ */
+static void *
+bin_malloc(size_t size, size_t asize)
+{
+	struct bin *bin = &bins[BIN_CLASS(asize)];
+	void *blocks[BIN_BATCH_MAX];
+	unsigned i, n;
+	void *bp;
+
+	pthread_mutex_lock(&bin->lock);
+	if ((bp = bin->head) != NULL) {
+		bin->head = *(void **)bp;
+		bin->count--;
+	}
+	pthread_mutex_unlock(&bin->lock);
+	if (bp != NULL)
+		return (bp);
+
+	// Fall back to the heap's own malloc, which consolidates the bins,
+	// only if no batch could be found or carved.
+	if ((n = bin_refill(asize, blocks)) == 0) {
+		heap_lock();
+		bp = default_malloc(size);
+		heap_unlock();
+		return (bp);
+	}
+	if (n > 1) {
+		pthread_mutex_lock(&bin->lock);
+		for (i = 1; i < n; i++) {
+			*(void **)blocks[i] = bin->head;
+			bin->head = blocks[i];
+		}
+		bin->count += n - 1;
+		pthread_mutex_unlock(&bin->lock);
+	}
+	return (blocks[0]);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block of the default heap of at
+ *   most BIN_MAXBLOCK bytes.
+ *
+ * Effects:
+ *   Push "bp" onto the bin of its class, and return a batch of the bin's
+ *   blocks to the free list if the bin is over BIN_CAP blocks.
+ */
+static void
+bin_free(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	struct bin *bin = &bins[BIN_CLASS(size)];
+	void *blocks[BIN_BATCH_MAX];
+	unsigned i, n = 0;
+
+	pthread_mutex_lock(&bin->lock);
+	*(void **)bp = bin->head;
+	bin->head = bp;
+	if (++bin->count > BIN_CAP) {
+		for (; n < (unsigned)BIN_BATCH(size); n++) {
+			blocks[n] = bin->head;
+			bin->head = *(void **)blocks[n];
+		}
+		bin->count -= n;
+	}
+	pthread_mutex_unlock(&bin->lock);
+	if (n == 0)
+		return;
+	heap_lock();
+	for (i = 0; i < n; i++)
+		default_free(blocks[i]);
+	heap_unlock();
+}
+
+/*
+ * Requires:
+ *   "asize" is the size of a binned block, and "blocks" has room for
+ *   BIN_BATCH_MAX blocks.
+ *
+ * Effects:
+ *   Allocate up to a batch of blocks of "asize" bytes into "blocks", from
+ *   the free list under the heap lock, growing a free wilderness if the
+ *   list holds no fit, or else carved from the top of the heap.  The
+ *   first block may be larger than "asize" if its fit was not worth
+ *   splitting.  Returns the number of blocks.
+ */
+static unsigned
+bin_refill(size_t asize, void **blocks)
+{
+	struct mm_heap *heap = &default_heap;
+	unsigned n, want = BIN_BATCH(asize);
+	void *bp;
+
+	heap_lock();
+	for (n = 0; n < want; n++) {
+		// Coalesce the deferred frees before growing the heap.
+		if ((bp = find_fit(heap, asize)) == NULL && n == 0 &&
+		    maint_deferred != NULL) {
+			maint_stats.drained += drain_deferred(SIZE_MAX);
+			bp = find_fit(heap, asize);
+		}
+
+		// Carving past a free wilderness would strand it, so grow it
+		// by the batch instead.
+		if (bp == NULL) {
+			if (n > 0)
+				break;
+			extend_lock(heap);
+			if ((bp = wilderness(heap)) != NULL)
+				bp = extend_heap(heap, (want * asize -
+				    GET_SIZE(HDRP(bp))) / WSIZE);
+			extend_unlock(heap);
+			if (bp == NULL)
+				break;
+		}
+		place(heap, bp, asize);
+
+		// An unsplit block can be larger than its class.
+		if (n > 0 && GET_SIZE(HDRP(bp)) != asize) {
+			mm_heap_free(heap, bp);
+			break;
+		}
+		blocks[n] = bp;
+	}
+	heap_unlock();
+	if (n == 0)
+		n = heap_carve(heap, asize, want, blocks);
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared.
+ *
+ * Effects:
+ *   Return the blocks of every bin whose lock is free to the free list.
+ *   Returns the number of blocks returned.
+ */
+static size_t
+bin_flush(void)
+{
+	struct bin *bin;
+	size_t n = 0;
+	unsigned cls;
+	void *bp;
+
+	for (cls = 0; cls < BIN_CLASSES; cls++) {
+		bin = &bins[cls];
+
+		// Leave a busy bin for a later flush rather than wait for it
+		// while holding the heap lock.
+		if (pthread_mutex_trylock(&bin->lock) != 0)
+			continue;
+		while ((bp = bin->head) != NULL) {
+			bin->head = *(void **)bp;
+			default_free(bp);
+			n++;
+		}
+		bin->count = 0;
+		pthread_mutex_unlock(&bin->lock);
+	}
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "asize" is a valid block size, and "blocks" has room for "n" blocks.
+ *
+ * Effects:
+ *   Grow "heap" by "n" allocated blocks of "asize" bytes each, without
+ *   touching its free list, so that only the extension lock is held.  A
+ *   free wilderness stays in the free list as an ordinary free block.
+ *   Returns the number of blocks carved, which is 0 if the heap cannot
+ *   grow.
+ */
+static unsigned
+heap_carve(struct mm_heap *heap, size_t asize, unsigned n, void **blocks)
+{
+	unsigned i;
+	char *bp;
+
+	extend_lock(heap);
+	if ((bp = mem_region_sbrk(heap->region, n * asize)) == (void *)-1) {
+		extend_unlock(heap);
+		return (0);
+	}
+	if (stats_enabled)
+		stats_add(stats_shard(), STATS_SBRKS, 1);
+	TRACE_FLAG(MM_TRACE_EXTENDED);
+
+	// The old epilogue header becomes the first block's header.  A
+	// reader under the heap lock that races with this sees either one
+	// as allocated.
+	PUT(bp + n * asize - WSIZE, PACK(0, 1));  // New epilogue header
+	for (i = 0; i < n; i++) {
+		PUT(HDRP(bp), PACK(asize, 1));
+		PUT(FTRP(bp), PACK(asize, 1));
+		blocks[i] = bp;
+		bp += asize;
+	}
+	__atomic_store_n(&heap->heap_end, bp, __ATOMIC_RELEASE);
+	extend_unlock(heap);
+	return (n);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Acquire "heap_mutex" if the heap is shared, that is, if several
+ *   threads may call the mm_malloc family or the maintenance thread is
+ *   running.
+ */
+static void
+heap_lock(void)
+{
+
+	if (threads_enabled || maint_running)
+		pthread_mutex_lock(&heap_mutex);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared.
+ *
+ * Effects:
+ *   Release "heap_mutex" if the heap is shared.
  */
 static void
-place(void *bp, size_t asize)
+heap_unlock(void)
 {
-	size_t csize = GET_SIZE(HDRP(bp));   
 
-	if ((csize - asize) >= (3 * DSIZE)) { 
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
-		remove_free((struct free_blk*)bp);
-		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0));
-		PUT(FTRP(bp), PACK(csize - asize, 0));
-		add_free((struct free_blk*)bp);
-	} else {
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
-		remove_free((struct free_blk*)bp);
+	if (threads_enabled || maint_running)
+		pthread_mutex_unlock(&heap_mutex);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Acquire "extend_mutex" if "heap" is the default heap and its bins are
+ *   in use, since the bins grow the heap without the heap lock.
+ */
+static void
+extend_lock(struct mm_heap *heap)
+{
+
+	if (bins_active && heap == &default_heap)
+		pthread_mutex_lock(&extend_mutex);
+}
+
+/*
+ * Requires:
+ *   The extension lock of "heap" is held.
+ *
+ * Effects:
+ *   Release "extend_mutex" if "heap" is the default heap and its bins are
+ *   in use.
+ */
+static void
+extend_unlock(struct mm_heap *heap)
+{
+
+	if (bins_active && heap == &default_heap)
+		pthread_mutex_unlock(&extend_mutex);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   The body of the maintenance thread: every "maint_interval"
+ *   microseconds, do one batch of work under "heap_mutex", then scavenge
+ *   the per-CPU caches without it, until asked to stop.
+ */
+static void *
+maint_main(void *arg)
+{
+	struct timespec ts;
+	unsigned idle_us;
+
+	(void)arg;
+	pthread_mutex_lock(&heap_mutex);
+	while (!maint_stopping) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long)maint_interval * 1000;
+		ts.tv_sec += ts.tv_nsec / 1000000000;
+		ts.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&maint_wake, &heap_mutex, &ts);
+		if (maint_stopping)
+			break;
+		maint_work(MAINT_BATCH);
+
+		// The scavenger returns blocks through cpucache_release,
+		// which takes the heap lock only if the transfer cache is
+		// full, and mm_init waits for it to finish.
+		if (cpucache_active) {
+			idle_us = cpucache_idle;
+			maint_scavenging = true;
+			pthread_mutex_unlock(&heap_mutex);
+			cpucache_scavenge(idle_us, cpucache_release);
+			pthread_mutex_lock(&heap_mutex);
+			maint_scavenging = false;
+			pthread_cond_broadcast(&maint_scavenged);
+		}
 	}
+	pthread_mutex_unlock(&heap_mutex);
+	return (NULL);
 }
 
 /*
- * Requires: 
- *     "bp" is the address of a block not already stored in the free list.
+ * Requires:
+ *   "heap_mutex" is held, or the maintenance thread has exited.
  *
  * Effects:
- *     Adds the block of memory from the free list.
+ *   Coalesce up to "budget" deferred frees, release the hugepages of up
+ *   to "budget" purge candidates, and trim the wilderness.
  */
 static void
-add_free(struct free_blk *bp)
+maint_work(size_t budget)
 {
-	((struct free_blk*) (free_listp->next))->prev = bp;
-	bp->next = free_listp->next;
-	bp->prev = free_listp;
-	free_listp->next = bp;
+	struct mm_heap *heap = &default_heap;
+	uintptr_t first, last;
+	size_t n;
+	void *bp;
+
+	// Wait for mm_init to create the default heap.
+	if (heap->heap_listp == NULL)
+		return;
+	extend_lock(heap);
+	maint_stats.wakeups++;
+	maint_stats.frees += drain_deferred(budget);
+
+	// Sweep every block if candidates were dropped, otherwise release
+	// the queued ones, which are still free blocks.
+	if (maint_sweep) {
+		for (bp = heap->heap_listp; GET_SIZE(HDRP(bp)) > 0;
+		     bp = NEXT_BLKP(bp))
+			if (!GET_ALLOC(HDRP(bp)))
+				maint_stats.purged += purge_block(bp);
+		maint_npurges = 0;
+		maint_sweep = false;
+	}
+	for (n = 0; n < budget && maint_npurges > 0; n++) {
+		bp = maint_purges[--maint_npurges];
+		maint_stats.purged += purge_block(bp);
+	}
+
+	// Trim the wilderness beyond its resident pad, once per change.
+	if ((bp = wilderness(heap)) != NULL && (bp != maint_trimmed ||
+	    GET_SIZE(HDRP(bp)) != maint_trimsize)) {
+		first = HP_UP((char *)bp + DSIZE + MAINT_TOP_PAD);
+		last = HP_DOWN((char *)bp + GET_SIZE(HDRP(bp)) - DSIZE);
+		if (first < last)
+			maint_stats.trimmed += mem_region_release(heap->region,
+			    (void *)first, last - first);
+		maint_trimmed = bp;
+		maint_trimsize = GET_SIZE(HDRP(bp));
+	}
+	extend_unlock(heap);
+	if (stats_page != NULL)
+		stats_publish();
 }
 
 /*
- * Requires: 
- *     "bp" is the address of a block already stored in the free list.
+ * Requires:
+ *   "heap_mutex" is held, or the maintenance thread is not running.
+ *
+ * Effects:
+ *   Free and coalesce up to "budget" of the deferred frees.  Returns the
+ *   number of blocks freed.
+ */
+static size_t
+drain_deferred(size_t budget)
+{
+	size_t n;
+	void *bp;
+
+	for (n = 0; n < budget && maint_deferred != NULL; n++) {
+		bp = maint_deferred;
+		maint_deferred = *(void **)bp;
+		mm_heap_free(&default_heap, bp);
+	}
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block of the default heap.
+ *
+ * Effects:
+ *   Release the whole hugepages inside "bp" if it has at least HP_RELEASE
+ *   bytes of them and is not the wilderness.  Returns the number of bytes
+ *   released.
+ */
+static size_t
+purge_block(void *bp)
+{
+	uintptr_t first = HP_UP((char *)bp + DSIZE);
+	uintptr_t last = HP_DOWN((char *)bp + GET_SIZE(HDRP(bp)) - DSIZE);
+
+	if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 || last < first + HP_RELEASE)
+		return (0);
+	return (mem_region_release(default_heap.region, (void *)first,
+	    last - first));
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and "bp" is the address of
+ *   a free block of the default heap that is leaving the free list, whose
+ *   header still holds the size it had when it was added.
  *
  * Effects:
- *     Removes the block of memory from the free list.
+ *   Remove "bp" from the queued purge candidates if it is one.  Only a
+ *   block with HP_RELEASE bytes of whole hugepages is ever queued, so
+ *   only such a block is looked for.
  */
 static void
-remove_free(struct free_blk *bp)
+purge_cancel(void *bp)
 {
-	((struct free_blk*) (bp->next))->prev = bp->prev;
-	((struct free_blk*) (bp->prev))->next = bp->next;
-	
+	uintptr_t first = HP_UP((char *)bp + DSIZE);
+	uintptr_t last = HP_DOWN((char *)bp + GET_SIZE(HDRP(bp)) - DSIZE);
+	unsigned i;
+
+	if (last < first + HP_RELEASE)
+		return;
+	for (i = 0; i < maint_npurges; i++) {
+		if (maint_purges[i] == bp) {
+			maint_purges[i] = maint_purges[--maint_npurges];
+			return;
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block allocated by mm_malloc or mm_realloc.
+ *
+ * Effects:
+ *   Returns the size of the block "bp" in bytes, including its overhead.
+ *   Heap blocks and nursery objects both keep their size in the word
+ *   before the payload.
+ */
+static size_t
+block_size(void *bp)
+{
+
+	if (span_enabled && span_owns(bp))
+		return (span_size(bp));
+	return (GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the calling thread's statistics shard, linking it on first
+ *   use.
+ */
+static struct stats_shard *
+stats_shard(void)
+{
+
+	if (!stats_local.linked)
+		stats_link();
+	return (&stats_local);
+}
+
+/*
+ * Requires:
+ *   The calling thread's shard is not linked.
+ *
+ * Effects:
+ *   Link the calling thread's shard onto "stats_shards", and arrange for
+ *   stats_unlink to fold it into "stats_retired" when the thread exits.
+ */
+static void
+stats_link(void)
+{
+
+	pthread_once(&stats_once, stats_key_create);
+	pthread_mutex_lock(&stats_mutex);
+	stats_local.next = stats_shards;
+	stats_shards = &stats_local;
+	stats_local.linked = true;
+	pthread_mutex_unlock(&stats_mutex);
+	pthread_setspecific(stats_key, &stats_local);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create the key whose destructor unlinks the shard of an exiting
+ *   thread.
+ */
+static void
+stats_key_create(void)
+{
+
+	pthread_key_create(&stats_key, stats_unlink);
+}
+
+/*
+ * Requires:
+ *   "arg" is the linked shard of the exiting thread.
+ *
+ * Effects:
+ *   Fold the shard into "stats_retired" and unlink it.
+ */
+static void
+stats_unlink(void *arg)
+{
+	struct stats_shard **shp, *sh = arg;
+
+	pthread_mutex_lock(&stats_mutex);
+	for (shp = &stats_shards; *shp != sh; shp = &(*shp)->next)
+		;
+	*shp = sh->next;
+	stats_fold(&stats_retired, sh);
+	memset(sh, 0, sizeof(*sh));
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+/*
+ * Requires:
+ *   "sh" is the calling thread's shard.
+ *
+ * Effects:
+ *   Add "n" to counter "c" of "sh".  Only the owner writes a shard, so a
+ *   plain load and store suffice, but mm_stats may read the counter from
+ *   another thread at any time.
+ */
+static void
+stats_add(struct stats_shard *sh, unsigned c, unsigned long n)
+{
+
+	__atomic_store_n(&sh->count[c], sh->count[c] + n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Requires:
+ *   "stats_mutex" is held.
+ *
+ * Effects:
+ *   Add the counters of "sh" to those of "sum".
+ */
+static void
+stats_fold(struct stats_shard *sum, struct stats_shard *sh)
+{
+	unsigned c;
+
+	for (c = 0; c < STATS_COUNTERS; c++)
+		sum->count[c] += __atomic_load_n(&sh->count[c],
+		    __ATOMIC_RELAXED);
+}
+
+/*
+ * Requires:
+ *   "bp" was just returned by mm_malloc, or is NULL.
+ *
+ * Effects:
+ *   Count a call to mm_malloc.
+ */
+static void
+stats_malloc(void *bp)
+{
+	struct stats_shard *sh = stats_shard();
+
+	stats_add(sh, STATS_MALLOCS, 1);
+	if (bp != NULL)
+		stats_add(sh, STATS_LIVE, block_size(bp));
+}
+
+/*
+ * Requires:
+ *   "bp" is about to be freed by mm_free, or is NULL.
+ *
+ * Effects:
+ *   Count a call to mm_free.
+ */
+static void
+stats_free(void *bp)
+{
+	struct stats_shard *sh = stats_shard();
+
+	stats_add(sh, STATS_FREES, 1);
+	if (bp != NULL)
+		stats_add(sh, STATS_LIVE, -block_size(bp));
+}
+
+/*
+ * Requires:
+ *   mm_realloc(ptr, size) just returned "newptr", and "oldsize" is the
+ *   size of the block "ptr" from before the call, or 0 if "ptr" is NULL.
+ *
+ * Effects:
+ *   Count a call to mm_realloc.
+ */
+static void
+stats_realloc(void *ptr, size_t oldsize, void *newptr, size_t size)
+{
+	struct stats_shard *sh = stats_shard();
+
+	// The old block survives only if the reallocation failed.
+	stats_add(sh, STATS_REALLOCS, 1);
+	if (newptr != NULL || size == 0)
+		stats_add(sh, STATS_LIVE, -oldsize);
+	if (newptr != NULL)
+		stats_add(sh, STATS_LIVE, block_size(newptr));
+	if (ptr != NULL && newptr != NULL)
+		stats_add(sh, newptr == ptr ? STATS_INPLACE : STATS_COPIES, 1);
+}
+
+/*
+ * Requires:
+ *   "size" is the size of a free block of the default heap.
+ *
+ * Effects:
+ *   Add the free block to "stats".
+ */
+static void
+stats_free_block(struct mm_stats *stats, size_t size)
+{
+
+	stats->free += size;
+	stats->largest_free = MAX(stats->largest_free, size);
+	stats->free_blocks[MIN(index_class(size), MM_STATS_CLASSES - 1)]++;
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and the extension lock is
+ *   not.
+ *
+ * Effects:
+ *   Copy the counts of requests and the sizes and free blocks of the heap
+ *   into "stats".
+ */
+static void
+stats_collect(struct mm_stats *stats)
+{
+	struct stats_shard *sh, sum;
+	struct free_blk *bp;
+	struct fit_class *fc;
+	unsigned c, i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	// Sum the shards of the exited and the live threads.
+	memset(&sum, 0, sizeof(sum));
+	pthread_mutex_lock(&stats_mutex);
+	stats_fold(&sum, &stats_retired);
+	for (sh = stats_shards; sh != NULL; sh = sh->next)
+		stats_fold(&sum, sh);
+	pthread_mutex_unlock(&stats_mutex);
+	stats->mallocs = sum.count[STATS_MALLOCS];
+	stats->frees = sum.count[STATS_FREES];
+	stats->reallocs = sum.count[STATS_REALLOCS];
+	stats->inplace = sum.count[STATS_INPLACE];
+	stats->copies = sum.count[STATS_COPIES];
+	stats->sbrks = sum.count[STATS_SBRKS];
+	stats->live = (long)sum.count[STATS_LIVE] > 0 ?
+	    sum.count[STATS_LIVE] : 0;
+
+	// Measure the free blocks of the default heap, which the bins grow
+	// under the extension lock alone.
+	stats->heap_size = mem_total_heapsize();
+	if (default_heap.heap_listp != NULL) {
+		extend_lock(&default_heap);
+		if (default_heap.index != NULL) {
+			for (c = 0; c < FIT_CLASSES; c++) {
+				fc = &default_heap.index->classes[c];
+				for (i = 0; i < fc->count; i++)
+					stats_free_block(stats,
+					    (size_t)fc->sizes[i] * DSIZE);
+			}
+		} else {
+			for (bp = default_heap.free_listp->next;
+			     bp != default_heap.free_listp; bp = bp->next)
+				stats_free_block(stats, GET_SIZE(HDRP(bp)));
+		}
+		extend_unlock(&default_heap);
+	}
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, the extension lock is not,
+ *   and "stats_page" is not NULL.
+ *
+ * Effects:
+ *   Rewrite the published page under its sequence lock.  The heap lock
+ *   makes this the only writer.
+ */
+static void
+stats_publish(void)
+{
+	struct mm_stats_page *page = stats_page;
+	unsigned long seq = page->seq;
+	struct mm_stats stats;
+
+	// Collect first, so that readers retry for as short a time as
+	// possible.
+	stats_collect(&stats);
+	__atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&page->stats, &stats, sizeof(stats));
+	page->updates++;
+	__atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+	stats_due();
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared.
+ *
+ * Effects:
+ *   Returns true if STATS_INTERVAL has passed since the last update of the
+ *   published page, and starts a new interval if so.
+ */
+static bool
+stats_due(void)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if (now - stats_published < STATS_INTERVAL)
+		return (false);
+	stats_published = now;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and so is the extension
+ *   lock of "heap".  "overhead->other" still counts the region of "heap".
+ *
+ * Effects:
+ *   Add the bytes of the region of "heap" to "overhead", classifying the
+ *   blocks of "ptrs" that lie in it by their requested "sizes".
+ */
+static void
+overhead_heap(struct mm_heap *heap, struct mm_overhead *overhead,
+    void **ptrs, const size_t *sizes, size_t n)
+{
+	size_t alloc = 0, asize, bsize, held = 0, region, walked = 0;
+	char *bp, *first;
+	size_t i;
+
+	// Walk the blocks after the prologue and the dummy head.
+	first = NEXT_BLKP(NEXT_BLKP(heap->heap_listp));
+	for (bp = first; (bsize = GET_SIZE(HDRP(bp))) > 0;
+	     bp = NEXT_BLKP(bp)) {
+		walked += bsize;
+		if (GET_ALLOC(HDRP(bp)))
+			alloc += bsize;
+		else if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)
+			overhead->wilderness += bsize;
+		else
+			overhead->fragmented += bsize;
+	}
+
+	// Split each held block into its payload, its tags, and the padding
+	// that adjust_size and place() added, in that order.
+	for (i = 0; i < n; i++) {
+		bp = ptrs[i];
+		if (bp < first || bp >= heap->heap_end)
+			continue;
+		bsize = GET_SIZE(HDRP(bp));
+		asize = adjust_size(sizes[i]);
+		held += bsize;
+		overhead->payload += sizes[i];
+		overhead->tags += DSIZE;
+		if (sizes[i] <= DSIZE) {
+			overhead->minimum += DSIZE - sizes[i];
+			overhead->special += asize - 2 * DSIZE;
+		} else {
+			overhead->rounding += ROUND(sizes[i]) - sizes[i];
+			overhead->special += asize - (ROUND(sizes[i]) + DSIZE);
+		}
+		overhead->unsplit += bsize - asize;
+	}
+
+	// The region holds the blocks and the heap's own metadata.
+	region = mem_region_size(heap->region);
+	overhead->cached += alloc - held;
+	overhead->metadata += region - walked;
+	overhead->other -= region;
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and so is the extension
+ *   lock of "heap".
+ *
+ * Effects:
+ *   Call "callback" with "ctx" for each block of "heap" after the
+ *   prologue and the dummy head, in address order.
+ */
+static void
+walk_heap(struct mm_heap *heap, mm_walk_t *callback, void *ctx)
+{
+	size_t bsize;
+	char *bp;
+
+	for (bp = NEXT_BLKP(NEXT_BLKP(heap->heap_listp));
+	     (bsize = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp))
+		callback(bp, bsize, GET_ALLOC(HDRP(bp)), ctx);
+}
+
+/*
+ * Requires:
+ *   "heap_mutex" is held if the heap is shared, and so is the extension
+ *   lock of "heap".  "words" has room for every block of "heap", or
+ *   "sh" and "words" are NULL.
+ *
+ * Effects:
+ *   Returns the number of blocks of "heap" after the prologue and the
+ *   dummy head, and unless "sh" is NULL, describes the heap in "sh" and
+ *   copies the block headers to "words".
+ */
+static unsigned long
+snapshot_heap(struct mm_heap *heap, struct mm_snapshot_heap *sh,
+    unsigned long *words)
+{
+	unsigned long n = 0;
+	char *bp, *first;
+
+	first = NEXT_BLKP(NEXT_BLKP(heap->heap_listp));
+	for (bp = first; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		if (words != NULL)
+			words[n] = GET(HDRP(bp));
+		n++;
+	}
+	if (sh != NULL) {
+		sh->base = (uintptr_t)mem_region_lo(heap->region);
+		sh->size = mem_region_size(heap->region);
+		sh->first = (uintptr_t)HDRP(first) - sh->base;
+		sh->blocks = n;
+	}
+	return (n);
 }
 
 /* 
@@ -465,19 +3339,19 @@ checkblock(void *bp)
  *   Perform a minimal check of the heap for consistency. 
  */
 void
-checkheap(bool verbose) 
+checkheap(struct mm_heap *heap, bool verbose) 
 {
 	void *bp;
 
 	if (verbose)
-		printf("Heap (%p):\n", heap_listp);
+		printf("Heap (%p):\n", heap->heap_listp);
 
-	if (GET_SIZE(HDRP(heap_listp)) != DSIZE ||
-	    !GET_ALLOC(HDRP(heap_listp)))
+	if (GET_SIZE(HDRP(heap->heap_listp)) != DSIZE ||
+	    !GET_ALLOC(HDRP(heap->heap_listp)))
 		printf("Bad prologue header\n");
-	checkblock(heap_listp);
+	checkblock(heap->heap_listp);
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	for (bp = heap->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 		if (verbose)
 			printblock(bp);
 		checkblock(bp);
@@ -499,12 +3373,12 @@ checkheap(bool verbose)
  */
 
 void
-check_freeblocks_free(void) 
+check_freeblocks_free(struct mm_heap *heap) 
 {
 	struct free_blk *start;
 	struct free_blk *next;
-	start = free_listp;
-	next = (struct free_blk*) free_listp->next;
+	start = heap->free_listp;
+	next = (struct free_blk*) heap->free_listp->next;
 	while (start != next) {
 		if (GET_ALLOC(next)) {
 			printf("block is not free \n");
@@ -522,13 +3396,13 @@ check_freeblocks_free(void)
  *     	blocks are free and not coalesced.
  */
 void 
-check_contiguous(void) 
+check_contiguous(struct mm_heap *heap) 
 {
         char* current;
 	char* next;
         char* start;
-	current = heap_listp;
-	start = heap_listp;
+	current = heap->heap_listp;
+	start = heap->heap_listp;
 	next = NEXT_BLKP(start);
 	while (start != next) {
 		if (GET_ALLOC(current) && !GET_ALLOC(next)) {
@@ -547,14 +3421,14 @@ check_contiguous(void)
  *     	Ensures that the bp pointer was successfully removed from the free memory list.
  */
 void 
-check_remove(void *bp) 
+check_remove(struct mm_heap *heap, void *bp) 
 {
 	bool my_switch;
 	char* current;
         char* start;
 
-	current = heap_listp;
-	start = heap_listp;
+	current = heap->heap_listp;
+	start = heap->heap_listp;
 	my_switch = false;
 	while (start != current) {
 		if (current == bp) {
@@ -575,14 +3449,14 @@ check_remove(void *bp)
  * 		Ensures that the bp pointer was successfully added from the free memory list.
  */
 void 
-check_add(void *bp) 
+check_add(struct mm_heap *heap, void *bp) 
 {
 	bool my_switch;
         char* current;
 	char* start;
 
-	current = heap_listp;
-	start = heap_listp;
+	current = heap->heap_listp;
+	start = heap->heap_listp;
 	my_switch = false;
 	while (start != current) {
 		if (current == bp) {
@@ -608,7 +3482,6 @@ printblock(void *bp)
 	size_t hsize, fsize;
 	bool halloc, falloc;
 
-	checkheap(false);
 	hsize = GET_SIZE(HDRP(bp));
 	halloc = GET_ALLOC(HDRP(bp));  
 	fsize = GET_SIZE(FTRP(bp));
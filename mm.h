@@ -8,6 +8,284 @@ void *mm_malloc(size_t size);
 void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Independent heaps, each with its own memory and free list.  The
+ * functions above operate on a default heap.
+ */
+typedef struct mm_heap mm_heap_t;
+
+mm_heap_t *mm_heap_create(size_t maxsize);
+void mm_heap_destroy(mm_heap_t *heap);
+void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+void mm_heap_free(mm_heap_t *heap, void *ptr);
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+
+/*
+ * Lifetime-segregated placement.  When enabled, size classes whose blocks
+ * have recently lived fewer than MM_SHORT_LIFETIME malloc/free/realloc
+ * operations are placed in a separate short-lived heap.
+ */
+#define MM_SHORT_LIFETIME 256
+
+void mm_lifetime_enable(int enable);
+int mm_lifetime_predicted_short(void *ptr);
+
+/*
+ * A nursery of pages in which small requests are bump allocated and whole
+ * pages are recycled once all of their objects have been freed.
+ */
+void mm_nursery_enable(int enable);
+
+/*
+ * A dense index of free block sizes per size class, searched with vector
+ * compares, in place of the free list.
+ */
+void mm_fit_index_enable(int enable);
+
+/*
+ * A tier of page spans for requests of 4 KB up to 1 MB, found on free
+ * through a pagemap instead of a block header.
+ */
+void mm_span_enable(int enable);
+
+/*
+ * Hugepage-aware layout: free blocks return their whole hugepages to the
+ * OS, and placement fills partially used hugepages before released ones.
+ */
+void mm_hugepage_enable(int enable);
+
+/*
+ * Calls from several threads at once, which take a lock around the
+ * default heap's free list and keep small free blocks in per-size-class
+ * bins with a lock each, and per-CPU caches of small free blocks in front
+ * of the heap instead of the bins, which use restartable sequences and
+ * need no lock.
+ */
+void mm_threads_enable(int enable);
+void mm_cpucache_enable(int enable);
+
+/*
+ * The capacity of each per-CPU cache grows on misses and shrinks when its
+ * blocks sit unused.  While the maintenance thread runs, it also returns
+ * every block cached on a CPU that has been idle for a while.  The total
+ * capacity of the caches, and so the bytes that they hold, is capped.
+ */
+struct mm_cpucache_stats {
+    size_t held;             /* Bytes of blocks in the caches */
+    size_t capacity;         /* Bytes that the caches may hold */
+    size_t limit;            /* Cap on the capacity */
+    unsigned long grown;     /* Capacity increases after misses */
+    unsigned long shrunk;    /* Capacity decreases by the scavenger */
+    size_t scavenged;        /* Bytes returned by the scavenger */
+};
+
+void mm_cpucache_limit(size_t bytes);
+void mm_cpucache_idle(unsigned idle_us);
+void mm_cpucache_stats(struct mm_cpucache_stats *stats);
+
+/*
+ * A background maintenance thread that takes coalescing, hugepage release
+ * and trimming of the heap top out of mm_free.  Start and stop it only
+ * while no other thread is inside the functions above.
+ */
+struct mm_maint_stats {
+    unsigned long wakeups;  /* Batches of work done */
+    unsigned long frees;    /* Deferred frees coalesced by the thread */
+    unsigned long drained;  /* Deferred frees coalesced by mm_malloc */
+    size_t purged;          /* Bytes of free hugepages released */
+    size_t trimmed;         /* Bytes released from the heap top */
+};
+
+int mm_maint_start(unsigned interval_us);
+void mm_maint_stop(void);
+void mm_maint_stats(struct mm_maint_stats *stats);
+
+/*
+ * Allocation statistics.  While counting is on, each thread counts its
+ * calls to the functions above in a shard of its own, and mm_stats sums
+ * the shards and measures the free blocks of the default heap.  Class c
+ * of "free_blocks" counts the free blocks of 2^(c+5) up to 2^(c+6) - 1
+ * bytes, and the last class counts every larger block.
+ */
+#define MM_STATS_CLASSES 20
+
+struct mm_stats {
+    size_t live;             /* Bytes of blocks allocated and not freed */
+    size_t heap_size;        /* Bytes of all heap regions */
+    size_t free;             /* Bytes of free blocks in the default heap */
+    size_t largest_free;     /* Bytes of its largest free block */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* Free blocks by class */
+    unsigned long mallocs;   /* Calls to mm_malloc */
+    unsigned long frees;     /* Calls to mm_free */
+    unsigned long reallocs;  /* Calls to mm_realloc */
+    unsigned long inplace;   /* Reallocs that kept their block */
+    unsigned long copies;    /* Reallocs that moved their block */
+    unsigned long sbrks;     /* Extensions of the heap regions */
+};
+
+void mm_stats_enable(int enable);
+void mm_stats(struct mm_stats *stats);
+
+/*
+ * A page of statistics mapped from a file, which monitors such as mmstat
+ * read without calling into the process.  The page is rewritten when the
+ * default heap grows, at mm_init, and at every wakeup of the maintenance
+ * thread, under a sequence lock: "seq" is odd while an update is in
+ * progress, and a reader retries until "seq" is even and unchanged
+ * across its copy of "stats".  The request counts stay zero unless
+ * counting is on.
+ */
+#define MM_STATS_MAGIC   0x6d6d7374  /* "mmst" */
+#define MM_STATS_VERSION 1
+
+struct mm_stats_page {
+    unsigned magic;          /* MM_STATS_MAGIC */
+    unsigned version;        /* MM_STATS_VERSION */
+    unsigned long seq;       /* Even while "stats" is consistent */
+    unsigned long pid;       /* Process that publishes the page */
+    unsigned long updates;   /* Updates so far */
+    struct mm_stats stats;
+};
+
+int mm_stats_publish(const char *path);
+
+/*
+ * A breakdown of every byte of the heap regions, given the blocks that the
+ * caller holds and the sizes that it requested for them.  The blocks of
+ * the default and short-lived heaps are split into their payload, their
+ * boundary tags, and the padding that adjust_size and place() add to it;
+ * the other bytes of those heaps are allocated blocks that the caller does
+ * not hold, free blocks, or the heaps' own metadata.  The fields sum to
+ * "heap_size".
+ */
+struct mm_overhead {
+    size_t heap_size;   /* Bytes of all heap regions */
+    size_t payload;     /* Bytes requested for the held blocks */
+    size_t tags;        /* Their headers and footers */
+    size_t rounding;    /* Their padding to the alignment */
+    size_t minimum;     /* Their padding of small requests to the minimum
+                           block, in place of rounding */
+    size_t special;     /* Their padding by the 448 and 112 byte cases */
+    size_t unsplit;     /* Their bytes beyond the adjusted size, which
+                           place() did not split off or mm_realloc kept */
+    size_t cached;      /* Allocated blocks that the caller does not hold,
+                           such as cached, binned and deferred frees */
+    size_t fragmented;  /* Free blocks below the wilderness */
+    size_t wilderness;  /* The free block at the top of each heap */
+    size_t metadata;    /* Prologues, free list heads and epilogues */
+    size_t other;       /* Other regions, such as the nursery, the spans
+                           and the fit indexes, with their blocks */
+};
+
+void mm_overhead(struct mm_overhead *overhead, void **ptrs,
+    const size_t *sizes, size_t n);
+
+/*
+ * Heap walks.  mm_heap_walk calls "callback" once for each block of the
+ * default and short-lived heaps, in address order within each heap, with
+ * the block's address, its size including the boundary tags, and whether
+ * its header marks it allocated, as blocks held by the caches, the bins
+ * and the deferred frees are.  The heaps stay locked during the walk, so
+ * "callback" must not call the functions above.
+ *
+ * mm_heap_snapshot copies the same blocks under the lock and writes them
+ * to a file descriptor after releasing it.  The snapshot holds a struct
+ * mm_snapshot_header, and then for each heap a struct mm_snapshot_heap
+ * followed by one word per block, its header: the block's size with bit
+ * 0 set if it is allocated.  The blocks are contiguous from "first" to
+ * the epilogue, and every other byte of the region is the heap's own
+ * metadata.  The nursery, the spans and the fit indexes are not included.
+ */
+typedef void mm_walk_t(void *ptr, size_t size, int allocated, void *ctx);
+
+#define MM_SNAPSHOT_MAGIC   0x6d6d736e  /* "mmsn" */
+#define MM_SNAPSHOT_VERSION 1
+
+struct mm_snapshot_header {
+    unsigned magic;          /* MM_SNAPSHOT_MAGIC */
+    unsigned version;        /* MM_SNAPSHOT_VERSION */
+    unsigned heaps;          /* Number of heaps that follow */
+    unsigned word_size;      /* sizeof(unsigned long) */
+};
+
+struct mm_snapshot_heap {
+    unsigned long base;      /* Lowest address of the heap's region */
+    unsigned long size;      /* Bytes of the region */
+    unsigned long first;     /* Offset of the first block's header */
+    unsigned long blocks;    /* Number of block words that follow */
+};
+
+void mm_heap_walk(mm_walk_t *callback, void *ctx);
+int mm_heap_snapshot(int fd);
+
+/*
+ * A consistency check of the default and short-lived heaps that prints
+ * any error it finds, and every block as well if "verbose" is set.
+ */
+void mm_checkheap(int verbose);
+
+/*
+ * Event tracing, compiled in with -DMM_TRACE ("make TRACE=1").  Every
+ * thread records each call to mm_malloc, mm_free and mm_realloc in a ring
+ * of its own that keeps its last MM_TRACE_EVENTS events, and
+ * mm_trace_dump writes every ring to a file that mmtrace prints.  The
+ * file holds a struct mm_trace_header, and then for each ring a struct
+ * mm_trace_ring followed by its events, oldest first.  Without
+ * -DMM_TRACE, mm_trace_dump fails with ENOTSUP.
+ */
+#define MM_TRACE_MAGIC   0x6d6d7472  /* "mmtr" */
+#define MM_TRACE_VERSION 1
+#define MM_TRACE_EVENTS  16384
+
+enum { MM_TRACE_MALLOC, MM_TRACE_FREE, MM_TRACE_REALLOC };
+
+#define MM_TRACE_COALESCED 0x1   /* The call merged free blocks */
+#define MM_TRACE_EXTENDED  0x2   /* The call grew a heap region */
+
+struct mm_trace_event {
+    unsigned long tsc;       /* Cycle counter at the start of the call */
+    unsigned long addr;      /* Block returned, or freed by mm_free */
+    unsigned long old;       /* Block passed to mm_realloc */
+    unsigned size;           /* Bytes requested, 0 for mm_free */
+    unsigned cycles;         /* Cycles that the call took */
+    unsigned visited;        /* Free blocks, or fit index classes, that
+                                the fit searches examined */
+    unsigned short op;       /* MM_TRACE_MALLOC, _FREE or _REALLOC */
+    unsigned short flags;    /* MM_TRACE_COALESCED and _EXTENDED */
+};
+
+struct mm_trace_header {
+    unsigned magic;          /* MM_TRACE_MAGIC */
+    unsigned version;        /* MM_TRACE_VERSION */
+    unsigned event_size;     /* sizeof(struct mm_trace_event) */
+    unsigned rings;          /* Number of rings that follow */
+};
+
+struct mm_trace_ring {
+    unsigned tid;            /* Thread that recorded the ring */
+    unsigned events;         /* Number of events that follow */
+    unsigned long dropped;   /* Older events that were overwritten */
+};
+
+int mm_trace_dump(const char *path);
+
+/*
+ * Heap profiling by sampling.  While sampling is on, mm_malloc and
+ * mm_realloc sample about one in every "interval" bytes that they
+ * allocate and record a backtrace of the sampled block until mm_free
+ * frees it.  mm_profile_dump writes the live and the cumulative samples
+ * of each backtrace since the last mm_init, either as a legacy pprof heap
+ * profile, which pprof scales back to bytes and symbolizes, or as folded
+ * stacks for flamegraph.pl, already scaled, with the live bytes under the
+ * root frame "live" and the cumulative bytes under "alloc".
+ */
+#define MM_PROFILE_INTERVAL (512 * 1024)  /* Default mean bytes per sample */
+
+enum { MM_PROFILE_PPROF, MM_PROFILE_FOLDED };
+
+void mm_profile_enable(size_t interval);
+int mm_profile_dump(const char *path, int format);
+
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal
  * names and login IDs in a struct of this type in their mm.c file.
@@ -0,0 +1,9 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * A free-granule bitmap allocator engine with the same interface as mm.h.
+ */
+
+int bitmap_init(void);
+void *bitmap_malloc(size_t size);
+void bitmap_free(void *ptr);
+void *bitmap_realloc(void *ptr, size_t size);
@@ -0,0 +1,322 @@
+/*
+ * A binary buddy allocator.  The heap is an "arena" of 2^A bytes at the
+ * start of the memlib heap, and every block is a power of two in size,
+ * from 2^BUDDY_MIN_ORDER bytes up to the whole arena, aligned to its own
+ * size relative to the start of the arena.  A block of order k at offset
+ * o has its buddy at offset o ^ 2^k.  When the arena has no large enough
+ * free block, it doubles: the new upper half becomes a free block of order
+ * A, which is merged with the old arena if that was entirely free.
+ *
+ * Blocks carry no header or footer; the whole block is payload.  Instead,
+ * the block structure is kept out of band in two bitmaps over a complete
+ * binary tree whose root is a block of order BUDDY_MAX_ORDER and whose
+ * leftmost subtree is the arena.  The "split" bit of a node is set when
+ * the node has been split into its two children, and the "free" bit is
+ * set when the node is a free block.  A node that is neither, and whose
+ * parent is split, is an allocated block.  mm_free finds the order of a
+ * block by descending from the arena through split nodes, and merging a
+ * block with its buddy only tests the buddy's free bit, so both splitting
+ * and merging take O(log n) time with no list scan.
+ *
+ * Free blocks of each order are kept on doubly-linked lists threaded
+ * through the free blocks themselves.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memlib.h"
+#include "mm_buddy.h"
+
+#define BUDDY_MIN_ORDER    4  // Smallest block: 16 bytes, two links
+#define BUDDY_MAX_ORDER    24 // Largest arena: 16 MB, under MAX_HEAP
+#define BUDDY_INIT_ORDER   12 // Initial arena: 4 KB
+
+// Number of nodes, plus one, in the tree of all possible blocks.
+#define BUDDY_NODES  (1 << (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1))
+
+// Given an order k and a byte offset o, compute the tree node of the
+// block of order k that contains o.
+#define NODE(k, o)  ((1 << (BUDDY_MAX_ORDER - (k))) + ((o) >> (k)))
+
+// Read, set, and clear bit n of bitmap map.
+#define GET_BIT(map, n)  (((map)[(n) / 8] >> ((n) % 8)) & 1)
+#define SET_BIT(map, n)  ((map)[(n) / 8] |= 1 << ((n) % 8))
+#define CLR_BIT(map, n)  ((map)[(n) / 8] &= ~(1 << ((n) % 8)))
+
+struct buddy_blk {
+	struct buddy_blk *prev;
+	struct buddy_blk *next;
+};
+
+/* Global variables: */
+static char *arena;           // First byte of the arena
+static unsigned arena_order;  // The arena is 2^arena_order bytes
+static unsigned max_order;    // Largest arena of any run, for buddy_init
+static unsigned long nonempty;  // Bit k is set if free_lists[k] is nonempty
+static struct buddy_blk *free_lists[BUDDY_MAX_ORDER + 1];
+static unsigned char split_map[BUDDY_NODES / 8];
+static unsigned char free_map[BUDDY_NODES / 8];
+
+/* Function prototypes for internal helper routines: */
+static bool grow_arena(void);
+static unsigned block_order(void *bp);
+static void push_free(void *bp, unsigned k);
+static void pop_free(void *bp, unsigned k);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Initialize the buddy allocator with a single free block of
+ *   2^BUDDY_INIT_ORDER bytes.  Returns 0 if the allocator was successfully
+ *   initialized and -1 otherwise.
+ */
+int
+buddy_init(void)
+{
+	unsigned k;
+	size_t first, count;
+
+	// Clear the bits that the previous arena may have used.
+	for (k = BUDDY_MIN_ORDER; k <= max_order; k++) {
+		first = NODE(k, 0);
+		count = (size_t)1 << (max_order - k);
+		memset(&split_map[first / 8], 0, (first + count + 7) / 8 -
+		    first / 8);
+		memset(&free_map[first / 8], 0, (first + count + 7) / 8 -
+		    first / 8);
+	}
+	memset(free_lists, 0, sizeof(free_lists));
+	nonempty = 0;
+
+	if ((arena = mem_sbrk((intptr_t)1 << BUDDY_INIT_ORDER)) ==
+	    (void *)-1)
+		return (-1);
+	arena_order = max_order = BUDDY_INIT_ORDER;
+	push_free(arena, arena_order);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload, unless "size"
+ *   is zero.  Returns the address of this block if the allocation was
+ *   successful and NULL otherwise.
+ */
+void *
+buddy_malloc(size_t size)
+{
+	unsigned j, k = BUDDY_MIN_ORDER;
+	char *bp;
+
+	// Ignore spurious requests.
+	if (size == 0 || size > ((size_t)1 << BUDDY_MAX_ORDER))
+		return (NULL);
+
+	// Round the request up to a power of two.
+	while (((size_t)1 << k) < size)
+		k++;
+
+	// Find the smallest nonempty free list of order k or above,
+	// doubling the arena until there is one.
+	while ((nonempty >> k) == 0)
+		if (!grow_arena())
+			return (NULL);
+	j = __builtin_ctzl(nonempty >> k) + k;
+
+	// Split the free block down to order k, freeing the upper halves.
+	bp = (char *)free_lists[j];
+	pop_free(bp, j);
+	while (j > k) {
+		SET_BIT(split_map, NODE(j, (size_t)(bp - arena)));
+		j--;
+		push_free(bp + ((size_t)1 << j), j);
+	}
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Free a block, merging it with its buddy for as long as the buddy is
+ *   also free.
+ */
+void
+buddy_free(void *bp)
+{
+	size_t off;
+	unsigned k;
+
+	// Ignore spurious requests.
+	if (bp == NULL)
+		return;
+
+	off = (char *)bp - arena;
+	k = block_order(bp);
+	while (k < arena_order &&
+	    GET_BIT(free_map, NODE(k, off ^ ((size_t)1 << k)))) {
+		pop_free(arena + (off ^ ((size_t)1 << k)), k);
+		off &= ~((size_t)1 << k);
+		k++;
+		CLR_BIT(split_map, NODE(k, off));
+	}
+	push_free(arena + off, k);
+}
+
+/*
+ * Requires:
+ *   "ptr" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Reallocates the block "ptr" to a block with at least "size" bytes of
+ *   payload, unless "size" is zero.  If "size" is zero, frees the block
+ *   "ptr" and returns NULL.  If the block "ptr" is already large enough,
+ *   "ptr" is returned.  Otherwise, a new block is allocated and the
+ *   contents of the old block "ptr" are copied to that new block.  Returns
+ *   the address of this new block if the allocation was successful and
+ *   NULL otherwise.
+ */
+void *
+buddy_realloc(void *ptr, size_t size)
+{
+	size_t oldsize;
+	void *newptr;
+
+	if (size == 0) {
+		buddy_free(ptr);
+		return (NULL);
+	} else if (ptr == NULL)
+		return (buddy_malloc(size));
+
+	oldsize = (size_t)1 << block_order(ptr);
+	if (size <= oldsize)
+		return (ptr);
+	if ((newptr = buddy_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, oldsize);
+	buddy_free(ptr);
+	return (newptr);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Double the arena, adding its new upper half as a free block and
+ *   merging that block with the old arena if the old arena is free.
+ *   Returns false if the arena could not grow.
+ */
+static bool
+grow_arena(void)
+{
+	size_t size = (size_t)1 << arena_order;
+
+	if (arena_order == BUDDY_MAX_ORDER || mem_sbrk(size) == (void *)-1)
+		return (false);
+
+	if (GET_BIT(free_map, NODE(arena_order, 0))) {
+		pop_free(arena, arena_order);
+		arena_order++;
+		push_free(arena, arena_order);
+	} else {
+		SET_BIT(split_map, NODE(arena_order + 1, 0));
+		push_free(arena + size, arena_order);
+		arena_order++;
+	}
+	if (arena_order > max_order)
+		max_order = arena_order;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   Returns the order of the block "bp", found by descending from the
+ *   arena through split nodes.
+ */
+static unsigned
+block_order(void *bp)
+{
+	size_t off = (char *)bp - arena;
+	unsigned k = arena_order;
+
+	while (k > BUDDY_MIN_ORDER && GET_BIT(split_map, NODE(k, off)))
+		k--;
+	return (k);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block of order "k" that is not free.
+ *
+ * Effects:
+ *   Mark the block free and push it on the free list of order "k".
+ */
+static void
+push_free(void *bp, unsigned k)
+{
+	struct buddy_blk *blk = bp;
+
+	SET_BIT(free_map, NODE(k, (size_t)((char *)bp - arena)));
+	blk->prev = NULL;
+	blk->next = free_lists[k];
+	if (blk->next != NULL)
+		blk->next->prev = blk;
+	free_lists[k] = blk;
+	nonempty |= 1UL << k;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block of order "k".
+ *
+ * Effects:
+ *   Mark the block allocated and remove it from the free list of order
+ *   "k".
+ */
+static void
+pop_free(void *bp, unsigned k)
+{
+	struct buddy_blk *blk = bp;
+
+	CLR_BIT(free_map, NODE(k, (size_t)((char *)bp - arena)));
+	if (blk->prev != NULL)
+		blk->prev->next = blk->next;
+	else
+		free_lists[k] = blk->next;
+	if (blk->next != NULL)
+		blk->next->prev = blk->prev;
+	if (free_lists[k] == NULL)
+		nonempty &= ~(1UL << k);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
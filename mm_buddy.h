@@ -0,0 +1,9 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * A binary buddy allocator engine with the same interface as mm.h.
+ */
+
+int buddy_init(void);
+void *buddy_malloc(size_t size);
+void buddy_free(void *ptr);
+void *buddy_realloc(void *ptr, size_t size);
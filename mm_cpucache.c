@@ -0,0 +1,650 @@
+/*
+ * Per-CPU caches of free blocks.  Every CPU owns a slab holding, for each
+ * of CPUCACHE_CLASSES size classes, a stack of up to CPUCACHE_CAP blocks
+ * and its count.  A thread pushes and pops the stacks of the CPU that it
+ * runs on inside a restartable sequence (rseq): a short critical section
+ * that reads the current CPU number from the thread's rseq area, finds
+ * the stack, and commits with a single store to the count.  If the thread
+ * is preempted, migrated or signalled before the commit, the kernel
+ * restarts the sequence from the top, so the stacks need no locks and no
+ * atomic instructions.
+ *
+ * The cache only stores pointers, and the caller decides which class a
+ * block belongs in.  Pushing onto a full stack and popping an empty one
+ * fail, and so does every operation when rseq is not available, which
+ * the caller handles through the locked heap.  The sequences are written
+ * for x86-64 Linux and rely on glibc registering an rseq area for every
+ * thread; elsewhere cpucache_init always fails.
+ *
+ * Behind the per-CPU stacks sits a central transfer cache: for each class,
+ * a stack of up to TRANSFER_CAP blocks under its own lock, which CPUs
+ * exchange whole batches through.  A CPU whose stack overflows hands a
+ * batch to the transfer cache, and one whose stack runs dry takes a batch
+ * back, so that a thread that frees what another allocates moves blocks
+ * between them with one lock round trip per batch, without touching the
+ * heap.  A batch holds about TRANSFER_BYTES bytes of blocks, between
+ * BATCH_MIN and CPUCACHE_BATCH_MAX blocks.
+ *
+ * The capacity of each stack adapts: it starts at zero, grows by a batch
+ * on every miss, up to CPUCACHE_CAP, and shrinks when its blocks sit
+ * unused.  Every pop records the stack's low-water mark, the fewest blocks
+ * that it held since the last scavenge, and cpucache_scavenge lowers the
+ * capacity by half of it, since those blocks were never needed.  The
+ * blocks above the lowered capacity stay put until the owner's own pushes
+ * overflow and hand them back in batches.  A CPU on which no push or pop
+ * happened for the idle period returns every cached block and all of its
+ * capacity instead.  Only the CPU that owns a stack may pop from it, so
+ * the scavenger pins itself to an idle CPU that still holds blocks, but
+ * never to an active one.
+ *
+ * The global limit on the capacity of all the stacks is split evenly into
+ * a budget per CPU, which each slab charges with atomic operations on its
+ * own counters, so growing a stack takes no lock.  Except for blocks that
+ * wait to be handed back after a scavenge, the bytes held in the stacks
+ * never exceed the limit.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define CPUCACHE_RSEQ
+#endif
+#endif
+
+#include "memlib.h"
+#include "mm.h"
+#include "mm_cpucache.h"
+
+#define SLAB_SHIFT  14                // log2 of the bytes per CPU slab
+#define SLAB_SIZE   (1 << SLAB_SHIFT)
+
+// Returns the slab of CPU "cpu".
+#define SLAB(cpu)  ((struct cpu_slab *)(slabs + ((size_t)(cpu) << SLAB_SHIFT)))
+
+struct cpu_slab {
+	uint32_t count[CPUCACHE_CLASSES];  // Blocks on each stack
+	uint32_t cap[CPUCACHE_CLASSES];    // Capacity of each stack
+	uint32_t low[CPUCACHE_CLASSES];    // Low-water mark of each stack
+	uint32_t ops;                      // Pushes and pops, wrapping
+	uint32_t seen_ops;                 // "ops" at the last scavenge
+	uint64_t active_us;                // When "ops" last changed
+	size_t bytes;                      // Capacity of the stacks (bytes)
+	unsigned long grown;               // Number of capacity increases
+	unsigned long shrunk;              // Number of capacity decreases
+	void *slots[CPUCACHE_CLASSES][CPUCACHE_CAP];  // The stacks
+};
+
+#define TRANSFER_CAP    (8 * CPUCACHE_CAP)  // Most blocks per central class
+#define TRANSFER_BYTES  2048   // Bytes of blocks moved per batch
+#define BATCH_MIN       4      // Fewest blocks moved per batch
+#define CPUCACHE_LIMIT  (1 << 20)  // Default limit on the total capacity
+
+struct transfer_class {
+	pthread_mutex_t lock;           // Protects the fields below
+	unsigned count;                 // Blocks on the stack
+	void *slots[TRANSFER_CAP];      // The stack
+};
+
+_Static_assert(sizeof(struct cpu_slab) <= SLAB_SIZE, "CPU slab too large");
+
+/* Global variables: */
+static mem_region_t *slab_region;  // Region holding the slabs
+static char *slabs;                // Slab of CPU 0
+static uint32_t ncpus;             // Number of slabs, 0 if disabled
+static struct transfer_class transfer[CPUCACHE_CLASSES];
+static unsigned batch[CPUCACHE_CLASSES];  // Blocks moved per batch
+
+static size_t limit = CPUCACHE_LIMIT;     // Most bytes that they may hold
+static size_t scavenged;                  // Bytes returned by scavenging
+
+#if defined(CPUCACHE_RSEQ)
+/* Function prototypes for internal helper routines: */
+static struct rseq *rseq_area(void);
+static uint64_t now_us(void);
+#endif
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create empty caches for every configured CPU.  Returns 0 if the
+ *   caches were created and -1 if they were not, for instance because
+ *   rseq is not available.
+ */
+int
+cpucache_init(void)
+{
+#if defined(CPUCACHE_RSEQ)
+	unsigned cls;
+	long n;
+
+	cpucache_deinit();
+
+	// glibc registers an rseq area unless rseq is unavailable or was
+	// disabled, in which case the CPU number is never valid.
+	if (__rseq_size == 0 || (int32_t)rseq_area()->cpu_id < 0)
+		return (-1);
+	if ((n = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+		return (-1);
+	if ((slab_region = mem_region_create((size_t)n * SLAB_SIZE)) == NULL)
+		return (-1);
+	slabs = mem_region_lo(slab_region);
+	ncpus = (uint32_t)n;
+	for (cls = 0; cls < CPUCACHE_CLASSES; cls++) {
+		pthread_mutex_init(&transfer[cls].lock, NULL);
+		transfer[cls].count = 0;
+		batch[cls] = TRANSFER_BYTES / CPUCACHE_SIZE(cls);
+		if (batch[cls] < BATCH_MIN)
+			batch[cls] = BATCH_MIN;
+		if (batch[cls] > CPUCACHE_BATCH_MAX)
+			batch[cls] = CPUCACHE_BATCH_MAX;
+	}
+	__atomic_store_n(&scavenged, 0, __ATOMIC_RELAXED);
+	return (0);
+#else
+	return (-1);
+#endif
+}
+
+/*
+ * Requires:
+ *   No other thread is using the caches.
+ *
+ * Effects:
+ *   Forget every cached block and release the caches.
+ */
+void
+cpucache_deinit(void)
+{
+	unsigned cls;
+
+	if (ncpus != 0) {
+		for (cls = 0; cls < CPUCACHE_CLASSES; cls++)
+			pthread_mutex_destroy(&transfer[cls].lock);
+	}
+	ncpus = 0;
+	if (slab_region != NULL) {
+		mem_region_destroy(slab_region);
+		slab_region = NULL;
+	}
+	slabs = NULL;
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES.
+ *
+ * Effects:
+ *   Pop a block of class "cls" from the cache of the current CPU.  Returns
+ *   the block, or NULL if that cache is empty or the caches are disabled.
+ */
+void *
+cpucache_pop(unsigned cls)
+{
+#if defined(CPUCACHE_RSEQ)
+	struct rseq *rs = rseq_area();
+	size_t c4 = (size_t)cls * 4;
+	size_t slot = offsetof(struct cpu_slab, slots[cls]);
+	void *bp;
+
+	// The count is the commit: the slot, the low-water mark and the
+	// operation count are read or stored before it.
+	__asm__ __volatile__(
+	    ".pushsection __rseq_cs, \"aw\"\n\t"
+	    ".balign 32\n"
+	    "3:\n\t"
+	    ".long 0, 0\n\t"
+	    ".quad 1f, 2f - 1f, 4f\n\t"
+	    ".popsection\n"
+	    "6:\n\t"
+	    "leaq 3b(%%rip), %%rax\n\t"
+	    "movq %%rax, %[cs]\n"
+	    "1:\n\t"
+	    "movl %[cpu], %%eax\n\t"
+	    "cmpl %[ncpus], %%eax\n\t"
+	    "jae 5f\n\t"
+	    "shlq %[shift], %%rax\n\t"
+	    "addq %[slabs], %%rax\n\t"
+	    "movl %c[count](%%rax, %[c4]), %%ecx\n\t"
+	    "testl %%ecx, %%ecx\n\t"
+	    "jz 5f\n\t"
+	    "decl %%ecx\n\t"
+	    "leaq (%%rax, %[slot]), %%rdx\n\t"
+	    "movq (%%rdx, %%rcx, 8), %[bp]\n\t"
+	    "cmpl %%ecx, %c[low](%%rax, %[c4])\n\t"
+	    "jbe 8f\n\t"
+	    "movl %%ecx, %c[low](%%rax, %[c4])\n"
+	    "8:\n\t"
+	    "incl %c[ops](%%rax)\n\t"
+	    "movl %%ecx, %c[count](%%rax, %[c4])\n"
+	    "2:\n\t"
+	    "jmp 7f\n\t"
+	    ".long %c[sig]\n"
+	    "4:\n\t"
+	    "jmp 6b\n"
+	    "5:\n\t"
+	    "xorl %k[bp], %k[bp]\n"
+	    "7:\n"
+	    : [bp] "=&r" (bp), [cs] "=m" (rs->rseq_cs)
+	    : [cpu] "m" (rs->cpu_id), [ncpus] "r" (ncpus),
+	      [slabs] "r" (slabs), [c4] "r" (c4), [slot] "r" (slot),
+	      [count] "i" (offsetof(struct cpu_slab, count)),
+	      [low] "i" (offsetof(struct cpu_slab, low)),
+	      [ops] "i" (offsetof(struct cpu_slab, ops)),
+	      [shift] "i" (SLAB_SHIFT), [sig] "i" (RSEQ_SIG)
+	    : "rax", "rcx", "rdx", "memory", "cc");
+	return (bp);
+#else
+	(void)cls;
+	return (NULL);
+#endif
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES and "bp" is a block of that class
+ *   that is not cached.
+ *
+ * Effects:
+ *   Push the block "bp" onto the cache of class "cls" of the current CPU.
+ *   Returns 0 if the block was cached and -1 if that cache is at its
+ *   capacity or the caches are disabled.
+ */
+int
+cpucache_push(unsigned cls, void *bp)
+{
+#if defined(CPUCACHE_RSEQ)
+	struct rseq *rs = rseq_area();
+	size_t c4 = (size_t)cls * 4;
+	size_t slot = offsetof(struct cpu_slab, slots[cls]);
+	int full;
+
+	// The count is the commit: the slot and the operation count are
+	// stored before it.
+	__asm__ __volatile__(
+	    ".pushsection __rseq_cs, \"aw\"\n\t"
+	    ".balign 32\n"
+	    "3:\n\t"
+	    ".long 0, 0\n\t"
+	    ".quad 1f, 2f - 1f, 4f\n\t"
+	    ".popsection\n"
+	    "6:\n\t"
+	    "leaq 3b(%%rip), %%rax\n\t"
+	    "movq %%rax, %[cs]\n"
+	    "1:\n\t"
+	    "movl %[cpu], %%eax\n\t"
+	    "cmpl %[ncpus], %%eax\n\t"
+	    "jae 5f\n\t"
+	    "shlq %[shift], %%rax\n\t"
+	    "addq %[slabs], %%rax\n\t"
+	    "movl %c[count](%%rax, %[c4]), %%ecx\n\t"
+	    "cmpl %c[cap](%%rax, %[c4]), %%ecx\n\t"
+	    "jae 5f\n\t"
+	    "leaq (%%rax, %[slot]), %%rdx\n\t"
+	    "movq %[bp], (%%rdx, %%rcx, 8)\n\t"
+	    "incl %%ecx\n\t"
+	    "incl %c[ops](%%rax)\n\t"
+	    "movl %%ecx, %c[count](%%rax, %[c4])\n"
+	    "2:\n\t"
+	    "xorl %[full], %[full]\n\t"
+	    "jmp 7f\n\t"
+	    ".long %c[sig]\n"
+	    "4:\n\t"
+	    "jmp 6b\n"
+	    "5:\n\t"
+	    "movl $1, %[full]\n"
+	    "7:\n"
+	    : [full] "=&r" (full), [cs] "=m" (rs->rseq_cs)
+	    : [cpu] "m" (rs->cpu_id), [ncpus] "r" (ncpus),
+	      [slabs] "r" (slabs), [c4] "r" (c4), [slot] "r" (slot),
+	      [bp] "r" (bp),
+	      [count] "i" (offsetof(struct cpu_slab, count)),
+	      [cap] "i" (offsetof(struct cpu_slab, cap)),
+	      [ops] "i" (offsetof(struct cpu_slab, ops)),
+	      [shift] "i" (SLAB_SHIFT), [sig] "i" (RSEQ_SIG)
+	    : "rax", "rcx", "rdx", "memory", "cc");
+	return (full ? -1 : 0);
+#else
+	(void)cls;
+	(void)bp;
+	return (-1);
+#endif
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES.
+ *
+ * Effects:
+ *   Record a miss on the cache of class "cls" of the current CPU by
+ *   growing its capacity by a batch, up to CPUCACHE_CAP, unless that would
+ *   take the CPU's capacity over its share of the limit or the cache still
+ *   holds more blocks than its capacity.  Returns 0 if the capacity grew
+ *   and -1 otherwise.
+ */
+int
+cpucache_grow(unsigned cls)
+{
+#if defined(CPUCACHE_RSEQ)
+	uint32_t cpu = rseq_area()->cpu_id;
+	struct cpu_slab *slab;
+	size_t bytes;
+	uint32_t cap;
+	unsigned add;
+
+	if (cpu >= ncpus)
+		return (-1);
+	slab = SLAB(cpu);
+	cap = __atomic_load_n(&slab->cap[cls], __ATOMIC_RELAXED);
+	if (__atomic_load_n(&slab->count[cls], __ATOMIC_RELAXED) > cap)
+		return (-1);
+	add = CPUCACHE_CAP - cap;
+	if (add > batch[cls])
+		add = batch[cls];
+	if (add == 0)
+		return (-1);
+
+	// Charge the CPU's budget first, and give it back if the capacity
+	// changed under a thread that migrated here or the scavenger.
+	bytes = (size_t)add * CPUCACHE_SIZE(cls);
+	if (__atomic_add_fetch(&slab->bytes, bytes, __ATOMIC_RELAXED) >
+	    __atomic_load_n(&limit, __ATOMIC_RELAXED) / ncpus ||
+	    !__atomic_compare_exchange_n(&slab->cap[cls], &cap, cap + add,
+	    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_sub_fetch(&slab->bytes, bytes, __ATOMIC_RELAXED);
+		return (-1);
+	}
+	__atomic_add_fetch(&slab->grown, 1, __ATOMIC_RELAXED);
+	return (0);
+#else
+	(void)cls;
+	return (-1);
+#endif
+}
+
+/*
+ * Requires:
+ *   No other thread scavenges at the same time, and "release" does not
+ *   use the caches.
+ *
+ * Effects:
+ *   Shrink the caches of every CPU.  On a CPU that saw a push or pop in
+ *   the last "idle_us" microseconds, lower each cache's capacity by half
+ *   of its low-water mark, leaving the owner to hand back the blocks
+ *   above it.  On any other CPU, pin the calling thread to it if it still
+ *   holds blocks, pass them all to "release" in batches, and drop all of
+ *   its capacity.  Returns the number of bytes returned.
+ */
+size_t
+cpucache_scavenge(unsigned idle_us, void (*release)(unsigned cls,
+    void **blocks, unsigned n))
+{
+#if defined(CPUCACHE_RSEQ)
+	void *blocks[CPUCACHE_BATCH_MAX];
+	struct cpu_slab *slab;
+	cpu_set_t mask, one;
+	size_t bytes = 0;
+	uint64_t now = now_us();
+	uint32_t cap, cpu, ops;
+	unsigned cls, done, n, want;
+	bool held, idle, pinned = false;
+
+	if (ncpus == 0 || sched_getaffinity(0, sizeof(mask), &mask) != 0)
+		return (0);
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		slab = SLAB(cpu);
+		ops = __atomic_load_n(&slab->ops, __ATOMIC_RELAXED);
+		if (ops != slab->seen_ops || slab->active_us == 0) {
+			slab->seen_ops = ops;
+			slab->active_us = now;
+		}
+		idle = (now - slab->active_us >= idle_us);
+		held = false;
+		for (cls = 0; cls < CPUCACHE_CLASSES && !held; cls++)
+			held = (__atomic_load_n(&slab->count[cls],
+			    __ATOMIC_RELAXED) > 0);
+
+		// Pop from an idle CPU's caches while running on it.
+		if (idle && held) {
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			if (sched_setaffinity(0, sizeof(one), &one) != 0)
+				continue;
+			pinned = true;
+			if (rseq_area()->cpu_id != cpu)
+				continue;
+		}
+		for (cls = 0; cls < CPUCACHE_CLASSES; cls++) {
+			want = idle && held ? slab->count[cls] : 0;
+			for (done = 0; done < want; done += n) {
+				for (n = 0; n < want - done && n < batch[cls];
+				     n++) {
+					if ((blocks[n] = cpucache_pop(cls)) ==
+					    NULL)
+						break;
+				}
+				if (n == 0)
+					break;
+				release(cls, blocks, n);
+			}
+			bytes += (size_t)done * CPUCACHE_SIZE(cls);
+
+			// Lower the capacity by half of the low-water mark, or
+			// drop all of it on an idle CPU.
+			want = __atomic_load_n(&slab->low[cls],
+			    __ATOMIC_RELAXED) / 2;
+			__atomic_store_n(&slab->low[cls], __atomic_load_n(
+			    &slab->count[cls], __ATOMIC_RELAXED),
+			    __ATOMIC_RELAXED);
+			cap = __atomic_load_n(&slab->cap[cls],
+			    __ATOMIC_RELAXED);
+			do {
+				n = (idle || want > cap) ? cap : want;
+			} while (n > 0 && !__atomic_compare_exchange_n(
+			    &slab->cap[cls], &cap, cap - n, false,
+			    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			if (n > 0) {
+				__atomic_sub_fetch(&slab->bytes,
+				    (size_t)n * CPUCACHE_SIZE(cls),
+				    __ATOMIC_RELAXED);
+				__atomic_add_fetch(&slab->shrunk, 1,
+				    __ATOMIC_RELAXED);
+			}
+		}
+
+		// The scavenger's own pops do not make the CPU active.
+		slab->seen_ops = __atomic_load_n(&slab->ops, __ATOMIC_RELAXED);
+	}
+	if (pinned)
+		sched_setaffinity(0, sizeof(mask), &mask);
+	__atomic_add_fetch(&scavenged, bytes, __ATOMIC_RELAXED);
+	return (bytes);
+#else
+	(void)idle_us;
+	(void)release;
+	return (0);
+#endif
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Cap the capacity of all the caches together at "bytes", of which
+ *   every CPU gets an even share.  Capacity beyond a CPU's share is not
+ *   taken back, but none of its caches grows until it is below it.
+ */
+void
+cpucache_limit(size_t bytes)
+{
+
+	__atomic_store_n(&limit, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Requires:
+ *   "stats" is a valid pointer.
+ *
+ * Effects:
+ *   Fill in "stats" with the bytes held in and allowed to the caches and
+ *   the activity of their sizing since cpucache_init.
+ */
+void
+cpucache_stats(struct mm_cpucache_stats *stats)
+{
+	struct cpu_slab *slab;
+	uint32_t cpu;
+	unsigned cls;
+
+	memset(stats, 0, sizeof(*stats));
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		slab = SLAB(cpu);
+		for (cls = 0; cls < CPUCACHE_CLASSES; cls++)
+			stats->held += (size_t)__atomic_load_n(
+			    &slab->count[cls], __ATOMIC_RELAXED) *
+			    CPUCACHE_SIZE(cls);
+		stats->capacity += __atomic_load_n(&slab->bytes,
+		    __ATOMIC_RELAXED);
+		stats->grown += __atomic_load_n(&slab->grown,
+		    __ATOMIC_RELAXED);
+		stats->shrunk += __atomic_load_n(&slab->shrunk,
+		    __ATOMIC_RELAXED);
+	}
+	stats->limit = __atomic_load_n(&limit, __ATOMIC_RELAXED);
+	stats->scavenged = __atomic_load_n(&scavenged, __ATOMIC_RELAXED);
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES.
+ *
+ * Effects:
+ *   Returns the number of blocks of class "cls" that move between a
+ *   per-CPU cache and the transfer cache or the heap at a time.
+ */
+unsigned
+cpucache_batch(unsigned cls)
+{
+
+	return (batch[cls]);
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES, and "blocks" holds "n" blocks of
+ *   that class that are not cached, where "n" is at most
+ *   cpucache_batch(cls).
+ *
+ * Effects:
+ *   Move the blocks to the transfer cache of class "cls".  Returns 0 if
+ *   they were moved and -1 if the transfer cache has no room for all of
+ *   them or the caches are disabled, in which case none was moved.
+ */
+int
+cpucache_transfer_insert(unsigned cls, void **blocks, unsigned n)
+{
+	struct transfer_class *tc = &transfer[cls];
+	int ret = -1;
+
+	if (ncpus == 0)
+		return (-1);
+	pthread_mutex_lock(&tc->lock);
+	if (tc->count + n <= TRANSFER_CAP) {
+		memcpy(&tc->slots[tc->count], blocks, n * sizeof(void *));
+		tc->count += n;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&tc->lock);
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   "cls" is less than CPUCACHE_CLASSES, and "blocks" has room for
+ *   cpucache_batch(cls) blocks.
+ *
+ * Effects:
+ *   Move up to one batch of blocks from the transfer cache of class "cls"
+ *   to "blocks".  Returns the number of blocks moved, which is 0 if that
+ *   transfer cache is empty or the caches are disabled.
+ */
+unsigned
+cpucache_transfer_remove(unsigned cls, void **blocks)
+{
+	struct transfer_class *tc = &transfer[cls];
+	unsigned n;
+
+	if (ncpus == 0)
+		return (0);
+	pthread_mutex_lock(&tc->lock);
+	n = (tc->count < batch[cls]) ? tc->count : batch[cls];
+	tc->count -= n;
+	memcpy(blocks, &tc->slots[tc->count], n * sizeof(void *));
+	pthread_mutex_unlock(&tc->lock);
+	return (n);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+#if defined(CPUCACHE_RSEQ)
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the rseq area that glibc registered for the calling thread.
+ */
+static struct rseq *
+rseq_area(void)
+{
+
+	return ((struct rseq *)((char *)__builtin_thread_pointer() +
+	    __rseq_offset));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the time of a monotonic clock in microseconds.
+ */
+static uint64_t
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+#endif
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
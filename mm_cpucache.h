@@ -0,0 +1,24 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * Per-CPU caches of free blocks, used by mm_malloc when enabled.
+ */
+
+#define CPUCACHE_CLASSES  31  // Number of size classes per CPU
+#define CPUCACHE_CAP      64  // Most blocks cached per class per CPU
+#define CPUCACHE_BATCH_MAX 16  // Most blocks moved per batch
+
+// Block size of class "cls", in bytes.
+#define CPUCACHE_SIZE(cls)  (((cls) + 2) * 16)
+
+int cpucache_init(void);
+void cpucache_deinit(void);
+void *cpucache_pop(unsigned cls);
+int cpucache_push(unsigned cls, void *bp);
+int cpucache_grow(unsigned cls);
+size_t cpucache_scavenge(unsigned idle_us, void (*release)(unsigned cls,
+    void **blocks, unsigned n));
+void cpucache_limit(size_t bytes);
+void cpucache_stats(struct mm_cpucache_stats *stats);
+unsigned cpucache_batch(unsigned cls);
+int cpucache_transfer_insert(unsigned cls, void **blocks, unsigned n);
+unsigned cpucache_transfer_remove(unsigned cls, void **blocks);
@@ -0,0 +1,531 @@
+/*
+ * A boundary tag allocator whose tags are kept out of band.  The heap is
+ * divided into granules of GRANULE bytes, and every block is a run of
+ * whole granules with no header or footer in it.  Instead, a separate
+ * metadata region holds a dense array of 16-bit tags indexed by granule
+ * offset from mem_heap_lo().  The tags of the first and last granules of
+ * every block hold the block's size in granules and whether it is
+ * allocated, just as an in-band header and footer would, so coalescing
+ * reads the neighboring tags in the array rather than the words around
+ * the payload.  A block of TAG_BIG granules or more, which a tag cannot
+ * describe, keeps its size in the two tags after its first tag and the
+ * two before its last tag.
+ *
+ * Two smaller arrays index the free blocks: a bitmap with one bit per
+ * granule marks the first granule of every free block, and a summary with
+ * one entry per 64 granules, one word of the bitmap, holds the size of the
+ * largest free block starting in those granules.  The fit search is first
+ * fit: it compares the summary eight entries at a time with SSE2 to skip
+ * every run of granules without a large enough free block, and then reads
+ * only the tags of the free blocks in the granules that remain.  Like
+ * mm.c, it passes over the wilderness, the free block that ends the heap,
+ * unless no other free block fits, and then grows the heap by exactly the
+ * missing granules.
+ *
+ * The metadata regions grow with the heap, and since they are memlib
+ * regions, mdriver counts them in the heap size: two bytes of tag, one
+ * bit of bitmap, and a quarter bit of summary per 16-byte granule.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "config.h"
+#include "memlib.h"
+#include "mm_oob.h"
+
+#define GRANULE      16      // Bytes per granule, the block alignment
+#define OOB_CHUNK    4096    // Extend the heap by at least this (bytes)
+#define OOB_GRANULES (MAX_HEAP / GRANULE)  // Most granules in the heap
+
+// Pack a size in granules and an allocated bit into a tag, and read them.
+// Sizes of TAG_BIG granules and more are kept in the neighboring tags.
+#define TAG_BIG          0x7FFF
+#define TAG(n, alloc)    ((uint16_t)((n) << 1 | (alloc)))
+#define TAG_SIZE(t)      ((size_t)(t) >> 1)
+#define TAG_ALLOC(t)     ((t) & 1)
+
+// Read, set, and clear bit g of the free block bitmap.
+#define SET_FREE(g)  (free_map[(g) / 64] |= (uint64_t)1 << ((g) % 64))
+#define CLR_FREE(g)  (free_map[(g) / 64] &= ~((uint64_t)1 << ((g) % 64)))
+
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+
+/* Global variables: */
+static char *heap_base;        // First byte of the heap, granule 0
+static size_t ngranules;       // Number of granules in the heap
+static size_t first_free;      // No free block starts below this granule
+static mem_region_t *tag_region;  // Region holding the tags
+static mem_region_t *map_region;  // Region holding the free block bitmap
+static mem_region_t *sum_region;  // Region holding the summary
+static uint16_t *tags;         // Tags of the first and last granules
+static uint64_t *free_map;     // Bit g is set if a free block starts at g
+static uint16_t *summary;      // Largest free block starting in each word
+
+/* Function prototypes for internal helper routines: */
+static size_t block_size(size_t g);
+static size_t prev_size(size_t g);
+static void set_block(size_t g, size_t n, bool alloc);
+static void add_free(size_t g);
+static void remove_free(size_t g);
+static size_t find_fit(size_t n, size_t wild);
+static size_t next_word(size_t w, size_t end, uint16_t need);
+static size_t wilderness(void);
+static bool grow_heap(size_t n);
+static void place(size_t g, size_t n);
+static void release(size_t g, size_t n);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Initialize the allocator with a free heap of OOB_CHUNK bytes.
+ *   Returns 0 if the allocator was successfully initialized and -1
+ *   otherwise.
+ */
+int
+oob_init(void)
+{
+
+	// Release the metadata of any previous heap.
+	if (tag_region != NULL)
+		mem_region_destroy(tag_region);
+	if (map_region != NULL)
+		mem_region_destroy(map_region);
+	if (sum_region != NULL)
+		mem_region_destroy(sum_region);
+	tag_region = map_region = sum_region = NULL;
+	ngranules = 0;
+	first_free = 0;
+
+	if ((tag_region = mem_region_create(OOB_GRANULES *
+	    sizeof(uint16_t))) == NULL ||
+	    (map_region = mem_region_create((OOB_GRANULES + 63) / 64 *
+	    sizeof(uint64_t))) == NULL ||
+	    (sum_region = mem_region_create((OOB_GRANULES + 63) / 64 *
+	    sizeof(uint16_t))) == NULL)
+		return (-1);
+	tags = mem_region_lo(tag_region);
+	free_map = mem_region_lo(map_region);
+	summary = mem_region_lo(sum_region);
+	heap_base = mem_heap_lo();
+	if (!grow_heap(OOB_CHUNK / GRANULE))
+		return (-1);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload, unless "size"
+ *   is zero.  Returns the address of this block if the allocation was
+ *   successful and NULL otherwise.
+ */
+void *
+oob_malloc(size_t size)
+{
+	size_t g, n, wild;
+
+	// Ignore spurious requests.
+	if (size == 0 || size > MAX_HEAP)
+		return (NULL);
+	n = (size + GRANULE - 1) / GRANULE;
+
+	// Only carve up the wilderness when no other block fits, growing
+	// the heap by the part of the request that it cannot cover.
+	wild = wilderness();
+	if ((g = find_fit(n, wild)) == SIZE_MAX) {
+		if (wild != SIZE_MAX) {
+			if (block_size(wild) < n &&
+			    !grow_heap(n - block_size(wild)))
+				return (NULL);
+			g = wild;
+		} else {
+			g = ngranules;
+			if (!grow_heap(MAX(n, OOB_CHUNK / GRANULE)))
+				return (NULL);
+		}
+	}
+	place(g, n);
+	return (heap_base + g * GRANULE);
+}
+
+/*
+ * Requires:
+ *   "bp" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Free a block, coalescing it with its free neighbors.
+ */
+void
+oob_free(void *bp)
+{
+	size_t g;
+
+	// Ignore spurious requests.
+	if (bp == NULL)
+		return;
+
+	g = ((char *)bp - heap_base) / GRANULE;
+	release(g, block_size(g));
+}
+
+/*
+ * Requires:
+ *   "ptr" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Reallocates the block "ptr" to a block with at least "size" bytes of
+ *   payload, unless "size" is zero.  If "size" is zero, frees the block
+ *   "ptr" and returns NULL.  If the block "ptr" is already large enough,
+ *   its unneeded granules are freed and "ptr" is returned.  If the next
+ *   block is free and large enough, or the block ends the heap, the block
+ *   grows in place.  Otherwise, a new block is allocated and the contents
+ *   of the old block "ptr" are copied to that new block.  Returns the
+ *   address of this new block if the allocation was successful and NULL
+ *   otherwise.
+ */
+void *
+oob_realloc(void *ptr, size_t size)
+{
+	size_t g, n, next, oldn;
+	void *newptr;
+
+	if (size == 0) {
+		oob_free(ptr);
+		return (NULL);
+	} else if (ptr == NULL)
+		return (oob_malloc(size));
+	if (size > MAX_HEAP)
+		return (NULL);
+
+	g = ((char *)ptr - heap_base) / GRANULE;
+	oldn = block_size(g);
+	n = (size + GRANULE - 1) / GRANULE;
+
+	// Shrink in place.
+	if (n <= oldn) {
+		if (n < oldn) {
+			set_block(g, n, true);
+			set_block(g + n, oldn - n, true);
+			release(g + n, oldn - n);
+		}
+		return (ptr);
+	}
+
+	// Grow in place into a free next block, or past the end of the heap.
+	next = g + oldn;
+	if (next < ngranules && !TAG_ALLOC(tags[next]) &&
+	    oldn + block_size(next) >= n) {
+		oldn += block_size(next);
+		remove_free(next);
+		set_block(g, n, true);
+		if (oldn > n) {
+			set_block(g + n, oldn - n, true);
+			release(g + n, oldn - n);
+		}
+		return (ptr);
+	}
+	if (next == ngranules && grow_heap(n - oldn)) {
+		// grow_heap made the new granules a free block.
+		remove_free(next);
+		set_block(g, n, true);
+		return (ptr);
+	}
+
+	if ((newptr = oob_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, oldn * GRANULE);
+	oob_free(ptr);
+	return (newptr);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "g" is the first granule of a block.
+ *
+ * Effects:
+ *   Returns the size in granules of the block "g".
+ */
+static size_t
+block_size(size_t g)
+{
+	size_t n = TAG_SIZE(tags[g]);
+
+	if (n == TAG_BIG)
+		n = tags[g + 1] | (size_t)tags[g + 2] << 16;
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "g" is greater than zero and is the first granule of a block or the
+ *   end of the heap.
+ *
+ * Effects:
+ *   Returns the size in granules of the block that ends just below "g".
+ */
+static size_t
+prev_size(size_t g)
+{
+	size_t n = TAG_SIZE(tags[g - 1]);
+
+	if (n == TAG_BIG)
+		n = tags[g - 2] | (size_t)tags[g - 3] << 16;
+	return (n);
+}
+
+/*
+ * Requires:
+ *   ["g", "g" + "n") is a range of granules in the heap.
+ *
+ * Effects:
+ *   Make the range a block by tagging its first and last granules.
+ */
+static void
+set_block(size_t g, size_t n, bool alloc)
+{
+
+	tags[g] = tags[g + n - 1] = TAG(MIN(n, TAG_BIG), alloc);
+	if (n >= TAG_BIG) {
+		tags[g + 1] = tags[g + n - 2] = (uint16_t)n;
+		tags[g + 2] = tags[g + n - 3] = (uint16_t)(n >> 16);
+	}
+}
+
+/*
+ * Requires:
+ *   "g" is the first granule of a free block that has been tagged.
+ *
+ * Effects:
+ *   Add the block "g" to the bitmap and the summary.
+ */
+static void
+add_free(size_t g)
+{
+	uint16_t n = MIN(block_size(g), TAG_BIG);
+
+	SET_FREE(g);
+	if (summary[g / 64] < n)
+		summary[g / 64] = n;
+	if (g < first_free)
+		first_free = g;
+}
+
+/*
+ * Requires:
+ *   "g" is the first granule of a free block in the bitmap, and the other
+ *   free blocks in its word of the bitmap are tagged.
+ *
+ * Effects:
+ *   Remove the block "g" from the bitmap, and recompute the summary of
+ *   its word from the free blocks that remain in it.
+ */
+static void
+remove_free(size_t g)
+{
+	size_t w = g / 64;
+	uint64_t bits;
+	uint16_t max = 0, n;
+
+	CLR_FREE(g);
+	for (bits = free_map[w]; bits != 0; bits &= bits - 1) {
+		n = MIN(block_size(w * 64 + __builtin_ctzll(bits)), TAG_BIG);
+		if (n > max)
+			max = n;
+	}
+	summary[w] = max;
+}
+
+/*
+ * Requires:
+ *   "wild" is the first granule of the wilderness or SIZE_MAX.
+ *
+ * Effects:
+ *   Returns the first granule of the first free block other than "wild"
+ *   with at least "n" granules, or SIZE_MAX if there is none.
+ */
+static size_t
+find_fit(size_t n, size_t wild)
+{
+	size_t end = (ngranules + 63) / 64, g, w;
+	uint16_t need = MIN(n, TAG_BIG);
+	uint64_t bits;
+
+	// Advance the lower bound past words without free blocks.
+	for (w = first_free / 64; w < end && free_map[w] == 0; w++)
+		;
+	first_free = w * 64;
+
+	for (w = next_word(w, end, need); w < end;
+	     w = next_word(w + 1, end, need)) {
+		for (bits = free_map[w]; bits != 0; bits &= bits - 1) {
+			g = w * 64 + __builtin_ctzll(bits);
+			if (g != wild && block_size(g) >= n)
+				return (g);
+		}
+	}
+	return (SIZE_MAX);
+}
+
+/*
+ * Requires:
+ *   "w" is at most "end".
+ *
+ * Effects:
+ *   Returns the first word of the bitmap in ["w", "end") whose summary is
+ *   at least "need", or "end" if there is none.
+ */
+static size_t
+next_word(size_t w, size_t end, uint16_t need)
+{
+#if defined(__SSE2__)
+	__m128i lim = _mm_set1_epi16((short)(need - 1));
+
+	// The summaries are at most TAG_BIG, so signed compares are exact.
+	while (w + 8 <= end && _mm_movemask_epi8(_mm_cmpgt_epi16(
+	    _mm_loadu_si128((const __m128i *)&summary[w]), lim)) == 0)
+		w += 8;
+#endif
+	while (w < end && summary[w] < need)
+		w++;
+	return (w);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the first granule of the wilderness, the free block that ends
+ *   the heap, or SIZE_MAX if the last block of the heap is allocated.
+ */
+static size_t
+wilderness(void)
+{
+
+	if (TAG_ALLOC(tags[ngranules - 1]))
+		return (SIZE_MAX);
+	return (ngranules - prev_size(ngranules));
+}
+
+/*
+ * Requires:
+ *   "n" is greater than zero.
+ *
+ * Effects:
+ *   Extend the heap and its metadata by "n" granules, which become a free
+ *   block coalesced with a free block that ended the heap.  Returns false
+ *   if the heap could not grow.
+ */
+static bool
+grow_heap(size_t n)
+{
+	size_t g = ngranules, words;
+
+	if (ngranules + n > OOB_GRANULES ||
+	    mem_sbrk(n * GRANULE) == (void *)-1)
+		return (false);
+
+	// Keep the metadata regions as large as the heap requires.
+	if (mem_region_sbrk(tag_region, n * sizeof(uint16_t)) == (void *)-1)
+		return (false);
+	words = (ngranules + n + 63) / 64 - (ngranules + 63) / 64;
+	if (words > 0) {
+		if (mem_region_sbrk(map_region, words * sizeof(uint64_t)) ==
+		    (void *)-1 || mem_region_sbrk(sum_region, words *
+		    sizeof(uint16_t)) == (void *)-1)
+			return (false);
+		memset(&free_map[(ngranules + 63) / 64], 0,
+		    words * sizeof(uint64_t));
+		memset(&summary[(ngranules + 63) / 64], 0,
+		    words * sizeof(uint16_t));
+	}
+	ngranules += n;
+
+	// Tag the new granules as allocated so that release can coalesce
+	// them with the wilderness.
+	set_block(g, n, true);
+	release(g, n);
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "g" is the first granule of a free block of at least "n" granules.
+ *
+ * Effects:
+ *   Allocate the first "n" granules of the free block "g", leaving the
+ *   rest of it as a free block.
+ */
+static void
+place(size_t g, size_t n)
+{
+	size_t size = block_size(g);
+
+	remove_free(g);
+	if (size > n) {
+		set_block(g + n, size - n, false);
+		add_free(g + n);
+	} else
+		n = size;
+	set_block(g, n, true);
+}
+
+/*
+ * Requires:
+ *   ["g", "g" + "n") is a tagged, allocated block.
+ *
+ * Effects:
+ *   Free the block, coalescing it with its free neighbors.
+ */
+static void
+release(size_t g, size_t n)
+{
+	size_t size;
+
+	// Merge with a free block that ends just below.
+	if (g > 0 && !TAG_ALLOC(tags[g - 1])) {
+		size = prev_size(g);
+		g -= size;
+		n += size;
+		remove_free(g);
+	}
+
+	// Merge with a free block that starts just above.
+	if (g + n < ngranules && !TAG_ALLOC(tags[g + n])) {
+		size = block_size(g + n);
+		remove_free(g + n);
+		n += size;
+	}
+	set_block(g, n, false);
+	add_free(g);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
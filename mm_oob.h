@@ -0,0 +1,10 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * A boundary tag allocator engine whose tags are kept out of band, with
+ * the same interface as mm.h.
+ */
+
+int oob_init(void);
+void *oob_malloc(size_t size);
+void oob_free(void *ptr);
+void *oob_realloc(void *ptr, size_t size);
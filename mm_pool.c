@@ -0,0 +1,333 @@
+/*
+ * Fixed-size object pools built on top of mm_malloc.  A pool carves
+ * chunks obtained from mm_malloc into equal slots.  Free slots are kept
+ * on an intrusive singly-linked list inside each chunk, so objects carry
+ * no header and allocating or freeing one never touches the heap's free
+ * list.  Chunks that still have free slots are kept on a doubly-linked
+ * "partial" list, and a chunk whose objects have all been freed is
+ * returned to the heap, apart from one spare that is kept to absorb
+ * churn at a chunk boundary.
+ *
+ * Because objects have no header, mm_pool_free finds an object's chunk by
+ * binary search of an address-ordered array of the pool's chunks.  That
+ * takes log2 of the number of chunks probes, where chunks aligned to
+ * their size would give the owner with a mask.  mm_malloc has no aligned
+ * allocation, though, and asking it for twice the chunk size to align
+ * one within would waste up to half of the pool's memory.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm.h"
+#include "mm_pool.h"
+
+#define WSIZE           sizeof(void *) // Word size (bytes)
+#define POOL_CHUNKSIZE  (1 << 12)      // Preferred chunk size (bytes)
+#define POOL_MINOBJS    8              // Minimum objects per chunk
+
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+
+// Rounds up to the nearest multiple of "align", a power of two.
+#define ALIGN_UP(x, align)  (((x) + ((align) - 1)) & ~((align) - 1))
+
+// Read and write the link word of a free slot.
+#define NEXT_FREE(obj)  (*(void **)(obj))
+
+/* A chunk of slots.  The slots follow the header. */
+struct pool_chunk {
+	struct pool_chunk *prev; // Previous chunk on the partial list
+	struct pool_chunk *next; // Next chunk on the partial list
+	void *free;              // First free slot in this chunk
+	char *slots;             // First slot, aligned to the pool's alignment
+	size_t live;             // Number of allocated slots
+};
+
+struct mm_pool {
+	size_t stride;              // Slot size (bytes)
+	size_t align;               // Slot alignment (bytes)
+	size_t nslots;              // Slots per chunk
+	size_t chunksize;           // Bytes requested from mm_malloc per chunk
+	struct pool_chunk *partial; // Chunks with at least one free slot
+	struct pool_chunk *spare;   // An empty chunk kept for reuse, or NULL
+	struct pool_chunk **chunks; // Every chunk, ordered by address
+	size_t nchunks;             // Number of chunks
+	size_t maxchunks;           // Capacity of "chunks"
+};
+
+/* Function prototypes for internal helper routines: */
+static struct pool_chunk *chunk_create(struct mm_pool *pool);
+static void chunk_destroy(struct mm_pool *pool, struct pool_chunk *chunk);
+static size_t chunk_index(struct mm_pool *pool, void *obj);
+static void partial_push(struct mm_pool *pool, struct pool_chunk *chunk);
+static void partial_remove(struct mm_pool *pool, struct pool_chunk *chunk);
+
+/*
+ * Requires:
+ *   "align" is zero or a power of two.
+ *
+ * Effects:
+ *   Create an empty pool of objects of "objsize" bytes, each aligned to
+ *   "align" bytes, or to the alignment of mm_malloc if "align" is zero.
+ *   Returns the pool if it was successfully created and NULL otherwise.
+ */
+mm_pool_t *
+mm_pool_create(size_t objsize, size_t align)
+{
+	struct mm_pool *pool;
+
+	if (objsize == 0 || (align & (align - 1)) != 0)
+		return (NULL);
+	if ((pool = mm_malloc(sizeof(struct mm_pool))) == NULL)
+		return (NULL);
+
+	// A free slot must be able to hold the link to the next one.
+	pool->align = MAX(align, WSIZE);
+	pool->stride = ALIGN_UP(MAX(objsize, WSIZE), pool->align);
+	pool->nslots = MAX(POOL_CHUNKSIZE / pool->stride, POOL_MINOBJS);
+
+	// Leave room to align the first slot past the header, which ends on
+	// a word boundary, so the slots start at most "align" - WSIZE bytes
+	// after it.
+	pool->chunksize = sizeof(struct pool_chunk) + pool->nslots *
+	    pool->stride + (pool->align - WSIZE);
+
+	pool->partial = NULL;
+	pool->spare = NULL;
+	pool->chunks = NULL;
+	pool->nchunks = 0;
+	pool->maxchunks = 0;
+	return (pool);
+}
+
+/*
+ * Requires:
+ *   "pool" was returned by mm_pool_create.
+ *
+ * Effects:
+ *   Free every chunk of "pool" and then "pool" itself.  Every object that
+ *   was allocated from "pool" becomes invalid.
+ */
+void
+mm_pool_destroy(mm_pool_t *pool)
+{
+	size_t i;
+
+	for (i = 0; i < pool->nchunks; i++)
+		mm_free(pool->chunks[i]);
+	mm_free(pool->chunks);
+	mm_free(pool);
+}
+
+/*
+ * Requires:
+ *   "pool" is a valid pool.
+ *
+ * Effects:
+ *   Allocate an object from "pool".  Returns the address of the object if
+ *   the allocation was successful and NULL otherwise.
+ */
+void *
+mm_pool_alloc(mm_pool_t *pool)
+{
+	struct pool_chunk *chunk;
+	void *obj;
+
+	if ((chunk = pool->partial) == NULL) {
+		// Reuse the spare chunk before asking the heap for one.
+		if ((chunk = pool->spare) != NULL)
+			pool->spare = NULL;
+		else if ((chunk = chunk_create(pool)) == NULL)
+			return (NULL);
+		partial_push(pool, chunk);
+	}
+
+	// Pop the first free slot.
+	obj = chunk->free;
+	chunk->free = NEXT_FREE(obj);
+	chunk->live++;
+	if (chunk->free == NULL)
+		partial_remove(pool, chunk);
+	return (obj);
+}
+
+/*
+ * Requires:
+ *   "obj" is either the address of an object allocated from "pool" or
+ *   NULL.
+ *
+ * Effects:
+ *   Free the object "obj".
+ */
+void
+mm_pool_free(mm_pool_t *pool, void *obj)
+{
+	struct pool_chunk *chunk;
+
+	// Ignore spurious requests.
+	if (obj == NULL)
+		return;
+
+	chunk = pool->chunks[chunk_index(pool, obj)];
+
+	// A full chunk regains a free slot.
+	if (chunk->free == NULL)
+		partial_push(pool, chunk);
+	NEXT_FREE(obj) = chunk->free;
+	chunk->free = obj;
+
+	// Return an empty chunk to the heap, unless it can be the spare.
+	if (--chunk->live == 0) {
+		partial_remove(pool, chunk);
+		if (pool->spare == NULL)
+			pool->spare = chunk;
+		else
+			chunk_destroy(pool, chunk);
+	}
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Obtain a new chunk from mm_malloc, thread all of its slots onto its
+ *   free list, and record it in the address-ordered chunk array.  Returns
+ *   the chunk or NULL if memory could not be obtained.
+ */
+static struct pool_chunk *
+chunk_create(struct mm_pool *pool)
+{
+	struct pool_chunk *chunk, **chunks;
+	size_t i, pos;
+	char *slot;
+
+	// Make room for the new chunk in the chunk array.
+	if (pool->nchunks == pool->maxchunks) {
+		if ((chunks = mm_realloc(pool->chunks, 2 * MAX(pool->maxchunks,
+		    4) * sizeof(struct pool_chunk *))) == NULL)
+			return (NULL);
+		pool->chunks = chunks;
+		pool->maxchunks = 2 * MAX(pool->maxchunks, 4);
+	}
+	if ((chunk = mm_malloc(pool->chunksize)) == NULL)
+		return (NULL);
+
+	chunk->slots = (char *)ALIGN_UP((uintptr_t)(chunk + 1), pool->align);
+	chunk->live = 0;
+	chunk->free = chunk->slots;
+	for (i = 0, slot = chunk->slots; i < pool->nslots - 1; i++) {
+		NEXT_FREE(slot) = slot + pool->stride;
+		slot += pool->stride;
+	}
+	NEXT_FREE(slot) = NULL;
+
+	// Insert the chunk in address order.
+	pos = 0;
+	if (pool->nchunks > 0 && (char *)pool->chunks[0] < (char *)chunk)
+		pos = chunk_index(pool, chunk) + 1;
+	memmove(&pool->chunks[pos + 1], &pool->chunks[pos],
+	    (pool->nchunks - pos) * sizeof(struct pool_chunk *));
+	pool->chunks[pos] = chunk;
+	pool->nchunks++;
+	return (chunk);
+}
+
+/*
+ * Requires:
+ *   "chunk" is an empty chunk of "pool" that is not on the partial list.
+ *
+ * Effects:
+ *   Remove "chunk" from the chunk array and return it to the heap.
+ */
+static void
+chunk_destroy(struct mm_pool *pool, struct pool_chunk *chunk)
+{
+	size_t pos = chunk_index(pool, chunk);
+
+	memmove(&pool->chunks[pos], &pool->chunks[pos + 1],
+	    (pool->nchunks - pos - 1) * sizeof(struct pool_chunk *));
+	pool->nchunks--;
+	mm_free(chunk);
+}
+
+/*
+ * Requires:
+ *   "pool" has at least one chunk and "obj" is at or above the address of
+ *   its lowest chunk.
+ *
+ * Effects:
+ *   Returns the index of the last chunk whose address is at or below
+ *   "obj", which is the chunk containing "obj" if any chunk does.
+ */
+static size_t
+chunk_index(struct mm_pool *pool, void *obj)
+{
+	size_t lo = 0, hi = pool->nchunks - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if ((char *)pool->chunks[mid] <= (char *)obj)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return (lo);
+}
+
+/*
+ * Requires:
+ *   "chunk" is not on the partial list.
+ *
+ * Effects:
+ *   Push "chunk" on the front of the partial list.
+ */
+static void
+partial_push(struct mm_pool *pool, struct pool_chunk *chunk)
+{
+
+	chunk->prev = NULL;
+	chunk->next = pool->partial;
+	if (pool->partial != NULL)
+		pool->partial->prev = chunk;
+	pool->partial = chunk;
+}
+
+/*
+ * Requires:
+ *   "chunk" is on the partial list.
+ *
+ * Effects:
+ *   Remove "chunk" from the partial list.
+ */
+static void
+partial_remove(struct mm_pool *pool, struct pool_chunk *chunk)
+{
+
+	if (chunk->prev != NULL)
+		chunk->prev->next = chunk->next;
+	else
+		pool->partial = chunk->next;
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk->prev;
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
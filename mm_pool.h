@@ -0,0 +1,11 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * Fixed-size object pools served from chunks obtained from mm_malloc.
+ */
+
+typedef struct mm_pool mm_pool_t;
+
+mm_pool_t *mm_pool_create(size_t objsize, size_t align);
+void mm_pool_destroy(mm_pool_t *pool);
+void *mm_pool_alloc(mm_pool_t *pool);
+void mm_pool_free(mm_pool_t *pool, void *obj);
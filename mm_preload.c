@@ -0,0 +1,368 @@
+/*
+ * The malloc family of the C library on top of mm.c, for libmm.so, which
+ * replaces the allocator of an unmodified program:
+ *
+ *	LD_PRELOAD=./libmm.so MM_TRACE_FILE=trace.bin <program>
+ *
+ * The first call initializes the default heap for several threads.  The
+ * heap is a memlib region of MAX_HEAP bytes, so a program that needs more
+ * sees malloc fail.  Alignments beyond the 16 bytes of every block are
+ * served from inside a larger block, with the address of that block in
+ * the word in front of the aligned one.  That word is always even, while
+ * the word in front of an ordinary block is its header, whose allocated
+ * bit is set.  The other engines keep no such header, so the library is
+ * only built on the boundary tag engine.  Pointers outside the memlib
+ * regions, which the dynamic linker may have allocated before the library
+ * was loaded, are never freed.  If MM_TRACE_FILE is set and the library
+ * was built with "make TRACE=1", the event rings are dumped to that file
+ * when the program exits.  If MM_PROFILE_FILE or MM_PROFILE_FOLDED is
+ * set, allocations are sampled about once every MM_PROFILE_INTERVAL
+ * bytes, or as many as that variable says, and the heap profile is dumped
+ * there at exit, for pprof or as folded stacks respectively.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#if defined(MM_BACKEND_BUDDY) || defined(MM_BACKEND_BITMAP) || \
+    defined(MM_BACKEND_OOB)
+#error "libmm.so needs the block headers of BACKEND=mm"
+#endif
+
+#define MIN_ALIGN  16  // Alignment of every block of mm_malloc
+
+// The words in front of a block with a larger alignment.
+struct aligned_hdr {
+	size_t size;          // Bytes requested
+	void *base;           // The block that holds it
+};
+
+/* Global variables: */
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+static int preload_failed;          // Did the heap fail to initialize?
+
+/* Function prototypes for internal helper routines: */
+static void preload_init(void);
+static void preload_exit(void);
+static bool init(void);
+static void *aligned_malloc(size_t align, size_t size);
+static struct aligned_hdr *aligned_hdr(void *ptr);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   malloc(3) on mm_malloc.
+ */
+void *
+malloc(size_t size)
+{
+	void *ptr;
+
+	if (!init())
+		return (NULL);
+	if ((ptr = mm_malloc(size != 0 ? size : 1)) == NULL)
+		errno = ENOMEM;
+	return (ptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   free(3) on mm_free.
+ */
+void
+free(void *ptr)
+{
+	struct aligned_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+	if (!mem_in_heap(ptr, ptr))
+		return;
+	if ((hdr = aligned_hdr(ptr)) != NULL)
+		ptr = hdr->base;
+	mm_free(ptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   calloc(3) on mm_malloc.
+ */
+void *
+calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	// Calling mm_malloc directly keeps the compiler from turning the
+	// malloc and memset back into a call to calloc.
+	if (!init())
+		return (NULL);
+	if ((ptr = mm_malloc(nmemb * size != 0 ? nmemb * size : 1)) == NULL) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	memset(ptr, 0, nmemb * size);
+	return (ptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   realloc(3) on mm_realloc.  A block with a larger alignment moves to
+ *   an ordinary block.
+ */
+void *
+realloc(void *ptr, size_t size)
+{
+	struct aligned_hdr *hdr;
+	void *newptr;
+
+	if (ptr == NULL)
+		return (malloc(size));
+	if (size == 0) {
+		free(ptr);
+		return (NULL);
+	}
+	if (!mem_in_heap(ptr, ptr)) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	if ((hdr = aligned_hdr(ptr)) != NULL) {
+		if ((newptr = malloc(size)) != NULL) {
+			memcpy(newptr, ptr, size < hdr->size ? size :
+			    hdr->size);
+			free(ptr);
+		}
+		return (newptr);
+	}
+	if ((newptr = mm_realloc(ptr, size)) == NULL)
+		errno = ENOMEM;
+	return (newptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   posix_memalign(3).
+ */
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+		return (EINVAL);
+	if ((ptr = aligned_malloc(alignment, size)) == NULL)
+		return (ENOMEM);
+	*memptr = ptr;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   aligned_alloc(3).
+ */
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	return (aligned_malloc(alignment, size));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   memalign(3).
+ */
+void *
+memalign(size_t alignment, size_t size)
+{
+
+	return (aligned_alloc(alignment, size));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   valloc(3).
+ */
+void *
+valloc(size_t size)
+{
+
+	return (aligned_malloc(getpagesize(), size));
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Initialize the memory model and the default heap for several
+ *   threads, and arrange for the dump at exit.
+ */
+static void
+preload_init(void)
+{
+
+	const char *interval = getenv("MM_PROFILE_INTERVAL");
+	bool profile = getenv("MM_PROFILE_FILE") != NULL ||
+	    getenv("MM_PROFILE_FOLDED") != NULL;
+
+	mem_init();
+	mm_threads_enable(1);
+	if (profile)
+		mm_profile_enable(interval != NULL ? strtoul(interval, NULL,
+		    0) : MM_PROFILE_INTERVAL);
+	if (mm_init() == -1) {
+		preload_failed = 1;
+		return;
+	}
+	if (getenv("MM_TRACE_FILE") != NULL || profile)
+		atexit(preload_exit);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Dump the event rings to the file named by MM_TRACE_FILE, and the heap
+ *   profile to the files named by MM_PROFILE_FILE and MM_PROFILE_FOLDED.
+ */
+static void
+preload_exit(void)
+{
+	static const char trace_msg[] = "libmm: mm_trace_dump failed\n";
+	static const char profile_msg[] = "libmm: mm_profile_dump failed\n";
+	const char *path;
+
+	if ((path = getenv("MM_TRACE_FILE")) != NULL &&
+	    mm_trace_dump(path) == -1)
+		write(STDERR_FILENO, trace_msg, sizeof(trace_msg) - 1);
+	if (((path = getenv("MM_PROFILE_FILE")) != NULL &&
+	    mm_profile_dump(path, MM_PROFILE_PPROF) == -1) ||
+	    ((path = getenv("MM_PROFILE_FOLDED")) != NULL &&
+	    mm_profile_dump(path, MM_PROFILE_FOLDED) == -1))
+		write(STDERR_FILENO, profile_msg, sizeof(profile_msg) - 1);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Initialize the heap on the first call.  Returns true if it is
+ *   initialized.
+ */
+static bool
+init(void)
+{
+
+	pthread_once(&preload_once, preload_init);
+	return (!preload_failed);
+}
+
+/*
+ * Requires:
+ *   "align" is a power of two.
+ *
+ * Effects:
+ *   Returns a block of "size" bytes aligned to "align", or NULL if none
+ *   could be allocated.
+ */
+static void *
+aligned_malloc(size_t align, size_t size)
+{
+	struct aligned_hdr *hdr;
+	char *base, *ptr;
+
+	if (align <= MIN_ALIGN)
+		return (malloc(size));
+	if (size > SIZE_MAX - align) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	// Both addresses are multiples of MIN_ALIGN, so the aligned block
+	// starts at least sizeof(*hdr) bytes into the larger one.
+	if ((base = malloc(size + align)) == NULL)
+		return (NULL);
+	ptr = (char *)(((uintptr_t)base + align) & ~(uintptr_t)(align - 1));
+	hdr = (struct aligned_hdr *)ptr - 1;
+	hdr->size = size;
+	hdr->base = base;
+	return (ptr);
+}
+
+/*
+ * Requires:
+ *   "ptr" is a block handed out by this library.
+ *
+ * Effects:
+ *   Returns the header of "ptr" if it is a block with a larger alignment,
+ *   and NULL otherwise.
+ */
+static struct aligned_hdr *
+aligned_hdr(void *ptr)
+{
+	struct aligned_hdr *hdr = (struct aligned_hdr *)ptr - 1;
+
+	return (((uintptr_t)hdr->base & 1) == 0 ? hdr : NULL);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
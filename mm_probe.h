@@ -0,0 +1,81 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * USDT probes of provider "mm", compiled in with -DMM_PROBES ("make
+ * PROBES=1").  Otherwise the macros below expand to nothing.  Each probe
+ * is a nop described by a note in the .note.stapsdt section, which
+ * tracers such as bpftrace and perf find without any help from the
+ * process, for instance:
+ *
+ *	bpftrace -e 'usdt:./mdriver:mm:find_fit_slow { @[arg0] = count(); }'
+ *
+ * Every argument is passed as an unsigned 64-bit value.  When
+ * <sys/sdt.h> is missing, the notes are emitted here in the same format,
+ * on x86-64 only.
+ */
+
+#if defined(MM_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PROBE_SDT
+#endif
+#endif
+
+#if defined(MM_PROBES)
+#if defined(PROBE_SDT)
+#include <sys/sdt.h>
+
+#define PROBE1(name, a1)  STAP_PROBE1(mm, name, (unsigned long)(a1))
+#define PROBE2(name, a1, a2)  \
+	STAP_PROBE2(mm, name, (unsigned long)(a1), (unsigned long)(a2))
+#define PROBE3(name, a1, a2, a3)  \
+	STAP_PROBE3(mm, name, (unsigned long)(a1), (unsigned long)(a2), \
+	    (unsigned long)(a3))
+#elif defined(__x86_64__)
+// A nop, and a version 3 stapsdt note holding its address, the address of
+// the .stapsdt.base section that tracers relocate it by, no semaphore,
+// the provider and probe names, and the location of each argument.
+#define PROBE_NOTE(name, args, ...)					\
+	__asm__ __volatile__(						\
+	    "990:	nop\n"						\
+	    "	.pushsection .note.stapsdt,\"\",\"note\"\n"		\
+	    "	.balign 4\n"						\
+	    "	.4byte 992f-991f, 994f-993f, 3\n"			\
+	    "991:	.asciz \"stapsdt\"\n"				\
+	    "992:	.balign 4\n"					\
+	    "993:	.8byte 990b\n"					\
+	    "	.8byte _.stapsdt.base\n"				\
+	    "	.8byte 0\n"						\
+	    "	.asciz \"mm\"\n"					\
+	    "	.asciz \"" #name "\"\n"					\
+	    "	.asciz \"" args "\"\n"					\
+	    "994:	.balign 4\n"					\
+	    "	.popsection\n"						\
+	    "	.ifndef _.stapsdt.base\n"				\
+	    "	.pushsection .stapsdt.base,\"aG\",\"progbits\","	\
+	    ".stapsdt.base,comdat\n"					\
+	    "	.weak _.stapsdt.base\n"					\
+	    "	.hidden _.stapsdt.base\n"				\
+	    "_.stapsdt.base:	.space 1\n"				\
+	    "	.size _.stapsdt.base, 1\n"				\
+	    "	.popsection\n"						\
+	    "	.endif\n"						\
+	    : : __VA_ARGS__)
+
+#define PROBE1(name, a1)						\
+	PROBE_NOTE(name, "8@%[p1]", [p1] "nor" ((unsigned long)(a1)))
+#define PROBE2(name, a1, a2)						\
+	PROBE_NOTE(name, "8@%[p1] 8@%[p2]",				\
+	    [p1] "nor" ((unsigned long)(a1)),				\
+	    [p2] "nor" ((unsigned long)(a2)))
+#define PROBE3(name, a1, a2, a3)					\
+	PROBE_NOTE(name, "8@%[p1] 8@%[p2] 8@%[p3]",			\
+	    [p1] "nor" ((unsigned long)(a1)),				\
+	    [p2] "nor" ((unsigned long)(a2)),				\
+	    [p3] "nor" ((unsigned long)(a3)))
+#else
+#error "MM_PROBES needs <sys/sdt.h> or x86-64"
+#endif
+#else
+#define PROBE1(name, a1)          do { } while (0)
+#define PROBE2(name, a1, a2)      do { } while (0)
+#define PROBE3(name, a1, a2, a3)  do { } while (0)
+#endif
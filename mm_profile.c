@@ -0,0 +1,591 @@
+/*
+ * A sampling heap profiler.  Each thread counts down the bytes that it
+ * allocates through mm_malloc and mm_realloc, and the request that crosses
+ * zero is sampled: its block is entered in a table of live sampled blocks
+ * together with its call site, a backtrace, and a new countdown is drawn
+ * from an exponential distribution with a mean of the sampling interval.
+ * The sample points thus form a Poisson process over the bytes allocated,
+ * and a block of s bytes is sampled with probability 1 - exp(-s/interval),
+ * by which the dump scales its samples back to bytes.  Freeing a sampled
+ * block removes it from the table.
+ *
+ * Each call site counts its live and its cumulative samples since the
+ * last mm_init.  The tables are static, so that the profiler also works
+ * where mm_malloc is the process's malloc, and samples beyond their
+ * capacity are not recorded.  A thread that allocates while it takes a
+ * backtrace, as the unwinder does on its first use, is not sampled.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "mm_profile.h"
+#include "mm_write.h"
+
+#define PROFILE_DEPTH     32         // Most frames of a backtrace
+#define PROFILE_SKIP      2          // Frames of the profiler and mm_malloc
+#define PROFILE_SITEBITS  12         // log2 of the call site table size
+#define PROFILE_SITES     (1 << PROFILE_SITEBITS)
+#define PROFILE_RECHECK   (1L << 30) // Bytes between checks while off
+
+struct profile_site {
+	uint64_t hash;              // Hash of the frames, 0 if the slot is empty
+	unsigned depth;             // Number of frames
+	unsigned long live_count;   // Live sampled blocks
+	unsigned long live_bytes;   // Their bytes
+	unsigned long alloc_count;  // Sampled blocks since mm_init
+	unsigned long alloc_bytes;  // Their bytes
+	void *frames[PROFILE_DEPTH];
+};
+
+struct profile_block {
+	void *bp;                   // Sampled block, or NULL for an empty slot
+	size_t size;                // Bytes requested for it
+	struct profile_site *site;  // Its call site
+};
+
+// A buffer of output for the file descriptor "fd".
+struct profile_out {
+	int fd;
+	int error;                  // Did a write fail?
+	size_t len;                 // Bytes in "buf"
+	char buf[8192];
+};
+
+/* Global variables: */
+__thread long profile_left;
+unsigned profile_nlive;
+unsigned short profile_homes[PROFILE_BLOCKS];
+static __thread bool profile_drawn;   // Is "profile_left" a drawn countdown?
+static __thread bool profile_busy;    // Is this thread inside the profiler?
+static __thread uint64_t profile_rng; // State of this thread's generator
+static long profile_interval;         // Mean bytes between samples, or 0
+static long profile_period;           // Last nonzero interval
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned profile_nsites;       // Number of call sites in the table
+static struct profile_site profile_sites[PROFILE_SITES];
+static unsigned short profile_used[PROFILE_SITES];  // Their slots
+static struct profile_block profile_blocks[PROFILE_BLOCKS];
+
+/* Function prototypes for internal helper routines: */
+static long profile_draw(long interval);
+static struct profile_site *site_find(void **frames, unsigned depth);
+static void block_insert(void *bp, size_t size, struct profile_site *site);
+static bool block_remove(void *bp);
+static void dump_pprof(struct profile_out *out);
+static void dump_folded(struct profile_out *out);
+static void dump_stack(struct profile_out *out, const char *root,
+    struct profile_site *site, unsigned long bytes);
+static void out_frame(struct profile_out *out, void *pc);
+static void out_printf(struct profile_out *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static void out_flush(struct profile_out *out);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Turn sampling on with a mean of "interval" bytes between samples, or
+ *   off if "interval" is zero.  The calling thread starts a new countdown
+ *   at once; other threads start one after their next sample, or within
+ *   PROFILE_RECHECK bytes while sampling was off.
+ */
+void
+mm_profile_enable(size_t interval)
+{
+
+	if (interval > 0)
+		__atomic_store_n(&profile_period, (long)interval,
+		    __ATOMIC_RELAXED);
+	__atomic_store_n(&profile_interval, (long)interval, __ATOMIC_RELAXED);
+	profile_left = 0;
+	profile_drawn = false;
+}
+
+/*
+ * Requires:
+ *   "format" is MM_PROFILE_PPROF or MM_PROFILE_FOLDED.
+ *
+ * Effects:
+ *   Write the samples of every call site to the file "path", which is
+ *   created or truncated.  Returns 0 if they were written and -1
+ *   otherwise.
+ */
+int
+mm_profile_dump(const char *path, int format)
+{
+	struct profile_out out;
+	int ret;
+
+	if ((out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return (-1);
+	out.error = 0;
+	out.len = 0;
+
+	// Nothing below allocates, so the table cannot change under the
+	// lock through this thread.
+	pthread_mutex_lock(&profile_mutex);
+	if (format == MM_PROFILE_FOLDED)
+		dump_folded(&out);
+	else
+		dump_pprof(&out);
+	out_flush(&out);
+	pthread_mutex_unlock(&profile_mutex);
+	ret = out.error ? -1 : 0;
+	if (close(out.fd) == -1)
+		ret = -1;
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   "bp" is the block of "size" bytes that mm_malloc or mm_realloc has
+ *   just allocated, or NULL, and this thread's countdown has crossed zero.
+ *
+ * Effects:
+ *   Sample "bp" if this thread's countdown was drawn, and draw a new one.
+ */
+void
+profile_malloc(void *bp, size_t size)
+{
+	void *frames[PROFILE_DEPTH + PROFILE_SKIP];
+	long interval = __atomic_load_n(&profile_interval, __ATOMIC_RELAXED);
+	struct profile_site *site;
+	bool drawn = profile_drawn;
+	int depth;
+
+	// While sampling is off, look again after PROFILE_RECHECK bytes.
+	if (interval == 0) {
+		profile_left = PROFILE_RECHECK;
+		profile_drawn = false;
+		return;
+	}
+	profile_left = profile_draw(interval);
+	profile_drawn = true;
+	if (!drawn || bp == NULL || profile_busy)
+		return;
+
+	profile_busy = true;
+	depth = backtrace(frames, PROFILE_DEPTH + PROFILE_SKIP);
+	if (depth > PROFILE_SKIP) {
+		pthread_mutex_lock(&profile_mutex);
+		if ((site = site_find(frames + PROFILE_SKIP,
+		    depth - PROFILE_SKIP)) != NULL)
+			block_insert(bp, size, site);
+		pthread_mutex_unlock(&profile_mutex);
+	}
+	profile_busy = false;
+}
+
+/*
+ * Requires:
+ *   "bp" is a block that is being freed, or NULL.
+ *
+ * Effects:
+ *   If "bp" was sampled, remove it from the live samples of its call
+ *   site.
+ */
+void
+profile_free(void *bp)
+{
+
+	if (bp == NULL)
+		return;
+	pthread_mutex_lock(&profile_mutex);
+	block_remove(bp);
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Forget every sample, and start a new countdown on this thread.
+ */
+void
+profile_reset(void)
+{
+	unsigned i;
+
+	// Clear only the slots in use, since mm_init runs often.
+	pthread_mutex_lock(&profile_mutex);
+	for (i = 0; i < profile_nsites; i++)
+		memset(&profile_sites[profile_used[i]], 0,
+		    sizeof(profile_sites[0]));
+	profile_nsites = 0;
+	if (profile_nlive > 0) {
+		memset(profile_blocks, 0, sizeof(profile_blocks));
+		memset(profile_homes, 0, sizeof(profile_homes));
+		__atomic_store_n(&profile_nlive, 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&profile_mutex);
+	profile_left = 0;
+	profile_drawn = false;
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "interval" is greater than zero.
+ *
+ * Effects:
+ *   Returns a number of bytes drawn from an exponential distribution with
+ *   mean "interval", from this thread's xorshift generator.
+ */
+static long
+profile_draw(long interval)
+{
+	struct timespec ts;
+	uint64_t x = profile_rng;
+	double u;
+
+	if (x == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		x = ((uint64_t)ts.tv_nsec << 20 ^ (uintptr_t)&profile_rng) | 1;
+	}
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	profile_rng = x;
+
+	// A uniform deviate in (0, 1], from the top 53 bits.
+	u = ((x * 2685821657736338717ULL >> 11) + 1) * 0x1p-53;
+	return ((long)(-log(u) * interval) + 1);
+}
+
+/*
+ * Requires:
+ *   "profile_mutex" is held, and "depth" is greater than zero.
+ *
+ * Effects:
+ *   Returns the call site with the "depth" frames at "frames", entering it
+ *   in the table if it is new, or NULL if the table is too full.
+ */
+static struct profile_site *
+site_find(void **frames, unsigned depth)
+{
+	struct profile_site *site;
+	uint64_t hash = 14695981039346656037ULL;
+	unsigned i;
+
+	if (depth > PROFILE_DEPTH)
+		depth = PROFILE_DEPTH;
+	for (i = 0; i < depth; i++)
+		hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ULL;
+	hash |= 1;
+
+	for (i = hash >> (64 - PROFILE_SITEBITS);; i = (i + 1) % PROFILE_SITES) {
+		site = &profile_sites[i];
+		if (site->hash == 0)
+			break;
+		if (site->hash == hash && site->depth == depth &&
+		    memcmp(site->frames, frames, depth * sizeof(*frames)) == 0)
+			return (site);
+	}
+	if (profile_nsites >= PROFILE_SITES / 4 * 3)
+		return (NULL);
+	site->hash = hash;
+	site->depth = depth;
+	memcpy(site->frames, frames, depth * sizeof(*frames));
+	profile_used[profile_nsites++] = site - profile_sites;
+	return (site);
+}
+
+/*
+ * Requires:
+ *   "profile_mutex" is held.
+ *
+ * Effects:
+ *   Record "bp", of "size" bytes, as a live sample of "site", in place of
+ *   any earlier sample of "bp", unless the table is too full to probe
+ *   quickly.
+ */
+static void
+block_insert(void *bp, size_t size, struct profile_site *site)
+{
+	unsigned i;
+
+	// A moving mm_realloc may have sampled the block through mm_malloc.
+	block_remove(bp);
+	if (profile_nlive >= PROFILE_BLOCKS / 4 * 3)
+		return;
+	for (i = PROFILE_HASH(bp); profile_blocks[i].bp != NULL;
+	     i = (i + 1) % PROFILE_BLOCKS)
+		;
+	profile_blocks[i].bp = bp;
+	profile_blocks[i].size = size;
+	profile_blocks[i].site = site;
+	__atomic_store_n(&profile_homes[PROFILE_HASH(bp)],
+	    profile_homes[PROFILE_HASH(bp)] + 1, __ATOMIC_RELAXED);
+	site->live_count++;
+	site->live_bytes += size;
+	site->alloc_count++;
+	site->alloc_bytes += size;
+	__atomic_store_n(&profile_nlive, profile_nlive + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Requires:
+ *   "profile_mutex" is held.
+ *
+ * Effects:
+ *   If "bp" is a live sample, remove it from the table and from the live
+ *   samples of its site.  Returns true if it was a live sample.
+ */
+static bool
+block_remove(void *bp)
+{
+	struct profile_site *site;
+	unsigned i, j, home;
+
+	for (i = PROFILE_HASH(bp); profile_blocks[i].bp != bp;
+	     i = (i + 1) % PROFILE_BLOCKS)
+		if (profile_blocks[i].bp == NULL)
+			return (false);
+	site = profile_blocks[i].site;
+	site->live_count--;
+	site->live_bytes -= profile_blocks[i].size;
+	__atomic_store_n(&profile_homes[PROFILE_HASH(bp)],
+	    profile_homes[PROFILE_HASH(bp)] - 1, __ATOMIC_RELAXED);
+
+	// Delete the slot, shifting back later entries of the same probe run.
+	for (j = (i + 1) % PROFILE_BLOCKS; profile_blocks[j].bp != NULL;
+	     j = (j + 1) % PROFILE_BLOCKS) {
+		home = PROFILE_HASH(profile_blocks[j].bp);
+		if ((j > i && (home <= i || home > j)) ||
+		    (j < i && (home <= i && home > j))) {
+			profile_blocks[i] = profile_blocks[j];
+			i = j;
+		}
+	}
+	profile_blocks[i].bp = NULL;
+	__atomic_store_n(&profile_nlive, profile_nlive - 1, __ATOMIC_RELAXED);
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "profile_mutex" is held.
+ *
+ * Effects:
+ *   Write the samples as a legacy heap profile of pprof, with the
+ *   sampling interval in the header so that pprof scales them to bytes,
+ *   followed by the memory map that pprof symbolizes the frames by.
+ */
+static void
+dump_pprof(struct profile_out *out)
+{
+	struct profile_site *site;
+	unsigned long live_count = 0, live_bytes = 0;
+	unsigned long alloc_count = 0, alloc_bytes = 0;
+	unsigned i, f;
+	ssize_t n;
+	int fd;
+
+	for (i = 0; i < profile_nsites; i++) {
+		site = &profile_sites[profile_used[i]];
+		live_count += site->live_count;
+		live_bytes += site->live_bytes;
+		alloc_count += site->alloc_count;
+		alloc_bytes += site->alloc_bytes;
+	}
+	out_printf(out, "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%ld\n",
+	    live_count, live_bytes, alloc_count, alloc_bytes,
+	    __atomic_load_n(&profile_period, __ATOMIC_RELAXED));
+	for (i = 0; i < profile_nsites; i++) {
+		site = &profile_sites[profile_used[i]];
+		if (site->alloc_count == 0)
+			continue;
+		out_printf(out, "%6lu: %8lu [%6lu: %8lu] @", site->live_count,
+		    site->live_bytes, site->alloc_count, site->alloc_bytes);
+		for (f = 0; f < site->depth; f++)
+			out_printf(out, " %#lx", (uintptr_t)site->frames[f]);
+		out_printf(out, "\n");
+	}
+
+	out_printf(out, "\nMAPPED_LIBRARIES:\n");
+	out_flush(out);
+	if ((fd = open("/proc/self/maps", O_RDONLY)) == -1) {
+		out->error = 1;
+		return;
+	}
+	while ((n = read(fd, out->buf, sizeof(out->buf))) > 0) {
+		out->len = n;
+		out_flush(out);
+	}
+	if (n == -1)
+		out->error = 1;
+	close(fd);
+}
+
+/*
+ * Requires:
+ *   "profile_mutex" is held.
+ *
+ * Effects:
+ *   Write the estimated bytes of each call site as folded stacks, outermost
+ *   frame first, under the root frame "live" for the live bytes and
+ *   "alloc" for the cumulative bytes.
+ */
+static void
+dump_folded(struct profile_out *out)
+{
+	struct profile_site *site;
+	double avg, period, scale;
+	unsigned i;
+
+	period = __atomic_load_n(&profile_period, __ATOMIC_RELAXED);
+	for (i = 0; i < profile_nsites; i++) {
+		site = &profile_sites[profile_used[i]];
+		if (site->alloc_count == 0)
+			continue;
+
+		// Blocks of the site's average size were sampled with
+		// probability 1 - exp(-avg/period).
+		avg = (double)site->alloc_bytes / site->alloc_count;
+		scale = 1 / -expm1(-avg / period);
+		if (site->live_count > 0)
+			dump_stack(out, "live", site,
+			    site->live_bytes * scale + 0.5);
+		dump_stack(out, "alloc", site, site->alloc_bytes * scale + 0.5);
+	}
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Write the frames of "site" as one folded stack under "root", with
+ *   the count "bytes".
+ */
+static void
+dump_stack(struct profile_out *out, const char *root,
+    struct profile_site *site, unsigned long bytes)
+{
+	unsigned f;
+
+	out_printf(out, "%s", root);
+	for (f = site->depth; f > 0; f--)
+		out_frame(out, site->frames[f - 1]);
+	out_printf(out, " %lu\n", bytes);
+}
+
+/*
+ * Requires:
+ *   "pc" is a return address.
+ *
+ * Effects:
+ *   Write ";" and the name of the function that holds the call before
+ *   "pc", or else the object and its offset in it, or else the address.
+ */
+static void
+out_frame(struct profile_out *out, void *pc)
+{
+	const ElfW(Sym) *sym = NULL;
+	char *addr = (char *)pc - 1;
+	const char *name;
+	Dl_info info;
+
+	if (dladdr1(addr, &info, (void **)&sym, RTLD_DL_SYMENT) == 0) {
+		out_printf(out, ";%#lx", (uintptr_t)addr);
+		return;
+	}
+
+	// dladdr names the nearest symbol below "addr", which is only the
+	// function that holds it if "addr" lies within the symbol.
+	if (info.dli_sname != NULL && sym != NULL &&
+	    addr < (char *)info.dli_saddr + sym->st_size) {
+		out_printf(out, ";%s", info.dli_sname);
+		return;
+	}
+	name = info.dli_fname != NULL ? info.dli_fname : "";
+	if (strrchr(name, '/') != NULL)
+		name = strrchr(name, '/') + 1;
+	out_printf(out, ";%s+%#lx", name, (uintptr_t)(addr -
+	    (char *)info.dli_fbase));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Append printf-style output to "out", writing out the buffer when it
+ *   fills.  Output beyond the size of the buffer is truncated.
+ */
+static void
+out_printf(struct profile_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt,
+	    ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if ((size_t)n >= sizeof(out->buf) - out->len) {
+		out_flush(out);
+		va_start(ap, fmt);
+		n = vsnprintf(out->buf, sizeof(out->buf), fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if ((size_t)n >= sizeof(out->buf))
+			n = sizeof(out->buf) - 1;
+	}
+	out->len += n;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Write the buffer of "out" to its file, resuming after short writes.
+ */
+static void
+out_flush(struct profile_out *out)
+{
+
+	if (write_all(out->fd, out->buf, out->len) == -1)
+		out->error = 1;
+	out->len = 0;
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,35 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * The sampling heap profiler of mm_profile.c, called by mm_malloc, mm_free
+ * and mm_realloc.  Until a thread's countdown of bytes crosses zero,
+ * PROFILE_MALLOC only decrements it.  PROFILE_FREE only reads
+ * "profile_nlive" while no sampled block is live, and otherwise the
+ * count of live samples in the home slot of the block being freed.
+ */
+
+#define PROFILE_BLOCKBITS 14  // log2 of the sampled block table size
+#define PROFILE_BLOCKS    (1 << PROFILE_BLOCKBITS)
+
+// Returns the slot of the block table where the search for bp starts.
+#define PROFILE_HASH(bp)  \
+	((uint32_t)((uintptr_t)(bp) / 16) * 2654435761u >> \
+	    (32 - PROFILE_BLOCKBITS))
+
+extern __thread long profile_left;  // Bytes until this thread's next sample
+extern unsigned profile_nlive;      // Number of live sampled blocks
+extern unsigned short profile_homes[PROFILE_BLOCKS];  // Samples per home
+
+void profile_malloc(void *bp, size_t size);
+void profile_free(void *bp);
+void profile_reset(void);
+
+#define PROFILE_MALLOC(bp, size)  do {					\
+	if ((profile_left -= (long)(size)) < 0)				\
+		profile_malloc((bp), (size));				\
+} while (0)
+#define PROFILE_FREE(bp)  do {						\
+	if (__atomic_load_n(&profile_nlive, __ATOMIC_RELAXED) != 0 &&	\
+	    __atomic_load_n(&profile_homes[PROFILE_HASH(bp)],		\
+	    __ATOMIC_RELAXED) != 0)					\
+		profile_free(bp);					\
+} while (0)
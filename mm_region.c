@@ -0,0 +1,202 @@
+/*
+ * A region allocator built on top of mm_malloc.  A region hands out
+ * memory by bumping a pointer through a chunk obtained from mm_malloc, and
+ * obtains a new chunk whenever the current one is exhausted.  Individual
+ * objects are never freed.  Instead, the region can be rolled back to a
+ * mark, or reset, which returns whole chunks to the heap with one mm_free
+ * each rather than one per object.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm.h"
+#include "mm_region.h"
+
+#define DSIZE            (2 * sizeof(void *)) // Payload alignment (bytes)
+#define REGION_CHUNKSIZE (1 << 12)            // Default chunk size (bytes)
+
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+
+// rounds up to the nearest multiple of DSIZE
+#define ROUND(size) (((size) + (DSIZE-1)) & ~(DSIZE-1))
+
+/*
+ * A chunk of a region.  The objects are bump allocated after the header,
+ * and the chunks form a stack from the newest to the oldest.
+ */
+struct region_chunk {
+	struct region_chunk *prev; // Next older chunk
+	char *limit;               // End of this chunk
+};
+
+#define CHUNK_HDRSIZE  ROUND(sizeof(struct region_chunk))
+
+struct mm_region {
+	struct region_chunk *chunk; // Newest chunk
+	char *top;                  // First free byte of the newest chunk
+	size_t chunksize;           // Size of an ordinary chunk
+};
+
+/* Function prototypes for internal helper routines: */
+static void *region_grow(struct mm_region *region, size_t size);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create an empty region that obtains memory from mm_malloc in chunks of
+ *   "chunksize" bytes, or of a default size if "chunksize" is zero.
+ *   Returns the region if it was successfully created and NULL otherwise.
+ */
+mm_region_t *
+mm_region_create(size_t chunksize)
+{
+	struct mm_region *region;
+
+	if ((region = mm_malloc(sizeof(struct mm_region))) == NULL)
+		return (NULL);
+	region->chunk = NULL;
+	region->top = NULL;
+	region->chunksize = (chunksize != 0) ? chunksize : REGION_CHUNKSIZE;
+	return (region);
+}
+
+/*
+ * Requires:
+ *   "region" was returned by mm_region_create.
+ *
+ * Effects:
+ *   Free every object in "region" and then "region" itself.
+ */
+void
+mm_region_destroy(mm_region_t *region)
+{
+
+	mm_region_reset(region);
+	mm_free(region);
+}
+
+/*
+ * Requires:
+ *   "region" is a valid region.
+ *
+ * Effects:
+ *   Allocate an object with at least "size" bytes of payload from
+ *   "region", unless "size" is zero.  Returns the address of this object
+ *   if the allocation was successful and NULL otherwise.
+ */
+void *
+mm_region_alloc(mm_region_t *region, size_t size)
+{
+	void *bp;
+
+	// Ignore spurious requests, and those whose rounded size or chunk
+	// size would wrap around.
+	if (size == 0 || size > SIZE_MAX - CHUNK_HDRSIZE - DSIZE)
+		return (NULL);
+
+	size = ROUND(size);
+	if (region->chunk == NULL ||
+	    size > (size_t)(region->chunk->limit - region->top))
+		return (region_grow(region, size));
+
+	// Bump the pointer within the current chunk.
+	bp = region->top;
+	region->top += size;
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "region" is a valid region.
+ *
+ * Effects:
+ *   Returns a mark for the current state of "region".
+ */
+mm_region_mark_t
+mm_region_mark(mm_region_t *region)
+{
+	mm_region_mark_t mark;
+
+	mark.chunk = region->chunk;
+	mark.top = region->top;
+	return (mark);
+}
+
+/*
+ * Requires:
+ *   "mark" was returned by mm_region_mark for "region", and "region" has
+ *   not been rolled back past "mark" since.
+ *
+ * Effects:
+ *   Free every object allocated from "region" after "mark" was taken.
+ */
+void
+mm_region_release(mm_region_t *region, mm_region_mark_t mark)
+{
+	struct region_chunk *chunk;
+
+	// Return the chunks that were obtained after the mark.
+	while (region->chunk != mark.chunk) {
+		chunk = region->chunk;
+		region->chunk = chunk->prev;
+		mm_free(chunk);
+	}
+	region->top = mark.top;
+}
+
+/*
+ * Requires:
+ *   "region" is a valid region.
+ *
+ * Effects:
+ *   Free every object allocated from "region".
+ */
+void
+mm_region_reset(mm_region_t *region)
+{
+	mm_region_mark_t empty = { NULL, NULL };
+
+	mm_region_release(region, empty);
+}
+
+/*
+ * Requires:
+ *   "size" is a multiple of DSIZE that does not fit in the current chunk.
+ *
+ * Effects:
+ *   Push a new chunk that is large enough for "size" bytes and allocate
+ *   them from it.  Returns the address of the object or NULL if mm_malloc
+ *   failed.
+ */
+static void *
+region_grow(struct mm_region *region, size_t size)
+{
+	struct region_chunk *chunk;
+	size_t csize = MAX(region->chunksize, CHUNK_HDRSIZE + size);
+
+	if ((chunk = mm_malloc(csize)) == NULL)
+		return (NULL);
+	chunk->prev = region->chunk;
+	chunk->limit = (char *)chunk + csize;
+	region->chunk = chunk;
+	region->top = (char *)chunk + CHUNK_HDRSIZE + size;
+	return ((char *)chunk + CHUNK_HDRSIZE);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,20 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * Regions: bump-pointer allocation out of large blocks obtained from
+ * mm_malloc, with stack-like rollback to a mark and bulk release.
+ */
+
+typedef struct mm_region mm_region_t;
+
+/* A position in a region that it can later be rolled back to. */
+typedef struct {
+	struct region_chunk *chunk; /* Chunk that was current at the mark. */
+	char *top;                  /* First free byte of that chunk. */
+} mm_region_mark_t;
+
+mm_region_t *mm_region_create(size_t chunksize);
+void mm_region_destroy(mm_region_t *region);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+mm_region_mark_t mm_region_mark(mm_region_t *region);
+void mm_region_release(mm_region_t *region, mm_region_mark_t mark);
+void mm_region_reset(mm_region_t *region);
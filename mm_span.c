@@ -0,0 +1,510 @@
+/*
+ * A page-level heap for requests of SPAN_MINSIZE up to SPAN_MAXSIZE bytes.
+ * Its memory is a region of SPAN_PAGESIZE pages, and every block is a
+ * "span" of contiguous pages that starts on a page boundary.  Spans carry
+ * no header or footer.  Instead, each span is described by a descriptor
+ * in a separate metadata region, and a pagemap maps page numbers to
+ * descriptors.  span_free finds the span from the page of the pointer,
+ * so freeing a block never touches its memory.
+ *
+ * The pagemap is a two-level radix tree over the page number of an
+ * address within the tier: the high bits select a leaf from a static
+ * root, and the low PM_LEAFBITS bits select the leaf's entry.  Leaves are
+ * allocated from the metadata region as the tier grows into them.  The
+ * first and last pages of every span are mapped, which is all that is
+ * needed: a pointer to a block is always in its first page, and the
+ * neighbors of a span are found through the pages just outside it.
+ *
+ * Free spans are kept on doubly-linked lists by length: list k holds the
+ * free spans of k + 1 pages, and the last list holds every free span of
+ * SPAN_LISTS pages or more, all of which are large enough for any request.
+ * A bitmask records the nonempty lists, so finding the shortest free span
+ * that fits takes a few word scans.  Freed spans are merged with free
+ * neighbors, and when no free span fits, the region grows by exactly the
+ * missing pages, merging with a free span that ends the region.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "memlib.h"
+#include "mm.h"
+#include "mm_span.h"
+
+#define SPAN_PAGESHIFT  12                     // log2 of the page size
+#define SPAN_PAGESIZE   (1 << SPAN_PAGESHIFT)  // Size of a page (bytes)
+#define SPAN_PAGES      (MAX_HEAP / SPAN_PAGESIZE)  // Most pages in the tier
+#define SPAN_LISTS      (SPAN_MAXSIZE / SPAN_PAGESIZE)  // Free span lists
+
+#define PM_LEAFBITS     7                      // Page number bits per leaf
+#define PM_LEAFSIZE     (1 << PM_LEAFBITS)     // Entries per leaf
+#define PM_ROOTSIZE     ((SPAN_PAGES + PM_LEAFSIZE) / PM_LEAFSIZE)  // Leaves
+
+// Compute the page number within the tier of an address.
+#define PAGE_NUM(p)  ((size_t)((char *)(p) - span_base) >> SPAN_PAGESHIFT)
+
+struct span {
+	char *start;        // First byte of the span
+	size_t npages;      // Length of the span in pages
+	bool free;          // Is the span free?
+	struct span *prev;  // Previous span of the same free list
+	struct span *next;  // Next span of the same free list, or spare
+};
+
+struct pm_leaf {
+	struct span *spans[PM_LEAFSIZE];  // Span of each page, if mapped
+};
+
+/* Global variables: */
+static mem_region_t *pages;  // Region holding the spans
+static mem_region_t *meta;   // Region holding descriptors and pagemap nodes
+static char *span_base;      // First page of the tier
+static size_t span_extent;   // Bytes of pages in use
+static struct span *spare;   // Stack of unused descriptors
+static struct pm_leaf *pm_root[PM_ROOTSIZE];  // Root of the pagemap
+static uint64_t nonempty[SPAN_LISTS / 64];  // Bit k: free_spans[k] nonempty
+static struct span *free_spans[SPAN_LISTS];
+
+/* Function prototypes for internal helper routines: */
+static struct span *new_span(char *start, size_t npages);
+static void map_span(struct span *sp);
+static struct span *pm_get(char *p);
+static bool pm_set(char *p, struct span *sp);
+static void push_free(struct span *sp);
+static void pop_free(struct span *sp);
+static void carve(struct span *sp, size_t npages);
+static struct span *find_span(size_t npages);
+
+/*
+ * Requires:
+ *   The tier is not initialized.
+ *
+ * Effects:
+ *   Initialize an empty tier.  Returns 0 if the tier was successfully
+ *   initialized and -1 otherwise.
+ */
+int
+span_init(void)
+{
+	size_t pad;
+
+	memset(pm_root, 0, sizeof(pm_root));
+	memset(nonempty, 0, sizeof(nonempty));
+	memset(free_spans, 0, sizeof(free_spans));
+	spare = NULL;
+	span_extent = 0;
+
+	// Every page may start a span, one more descriptor is briefly needed
+	// while a span is split, and every leaf of the pagemap may be used.
+	if ((pages = mem_region_create(MAX_HEAP + SPAN_PAGESIZE)) == NULL)
+		return (-1);
+	if ((meta = mem_region_create((SPAN_PAGES + 2) * sizeof(struct span) +
+	    PM_ROOTSIZE * sizeof(struct pm_leaf))) == NULL) {
+		span_deinit();
+		return (-1);
+	}
+
+	// Align the first page to a page boundary.
+	pad = -(uintptr_t)mem_region_lo(pages) & (SPAN_PAGESIZE - 1);
+	if (mem_region_sbrk(pages, pad) == (void *)-1) {
+		span_deinit();
+		return (-1);
+	}
+	span_base = (char *)mem_region_lo(pages) + pad;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Release the tier, if it is initialized.  Every block that was
+ *   allocated from it becomes invalid.
+ */
+void
+span_deinit(void)
+{
+
+	if (pages != NULL)
+		mem_region_destroy(pages);
+	if (meta != NULL)
+		mem_region_destroy(meta);
+	pages = meta = NULL;
+	span_base = NULL;
+	span_extent = 0;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns true if "ptr" is in a page of the tier and false otherwise.
+ */
+int
+span_owns(void *ptr)
+{
+
+	return ((uintptr_t)((char *)ptr - span_base) < span_extent);
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of a span allocated by span_malloc or
+ *   span_realloc.
+ *
+ * Effects:
+ *   Returns the size of the span "ptr" in bytes.
+ */
+size_t
+span_size(void *ptr)
+{
+
+	return (pm_get(ptr)->npages << SPAN_PAGESHIFT);
+}
+
+/*
+ * Requires:
+ *   The tier is initialized.
+ *
+ * Effects:
+ *   Allocate a span of enough pages for "size" bytes.  Returns the address
+ *   of its first page if the allocation was successful and NULL otherwise.
+ */
+void *
+span_malloc(size_t size)
+{
+	size_t npages = (size + SPAN_PAGESIZE - 1) >> SPAN_PAGESHIFT;
+	struct span *sp;
+
+	if (size == 0 || (sp = find_span(npages)) == NULL)
+		return (NULL);
+	carve(sp, npages);
+	return (sp->start);
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of a span allocated by span_malloc or
+ *   span_realloc.
+ *
+ * Effects:
+ *   Free the span "ptr", merging it with its free neighbors.
+ */
+void
+span_free(void *ptr)
+{
+	struct span *next, *prev, *sp = pm_get(ptr);
+	char *end = sp->start + (sp->npages << SPAN_PAGESHIFT);
+
+	// Merge with the span that ends just below.
+	if ((char *)ptr > span_base &&
+	    (prev = pm_get((char *)ptr - SPAN_PAGESIZE))->free) {
+		pop_free(prev);
+		prev->npages += sp->npages;
+		sp->next = spare;
+		spare = sp;
+		sp = prev;
+	}
+
+	// Merge with the span that starts just above.
+	if (end < span_base + span_extent && (next = pm_get(end))->free) {
+		pop_free(next);
+		sp->npages += next->npages;
+		next->next = spare;
+		spare = next;
+	}
+	map_span(sp);
+	push_free(sp);
+}
+
+/*
+ * Requires:
+ *   "ptr" is either the address of a span allocated by span_malloc or
+ *   span_realloc or NULL, and "alloc" allocates blocks like mm_malloc.
+ *
+ * Effects:
+ *   Reallocates the span "ptr" for "size" bytes.  If "size" is zero,
+ *   frees the span and returns NULL.  A span shrinks in place, releasing
+ *   its unneeded pages, and grows in place when the span above it is free
+ *   and long enough or the span ends the tier.  Otherwise, a new block is
+ *   allocated with "alloc" and the contents of the span are copied to it.
+ *   Returns the address of the block if the reallocation was successful
+ *   and NULL otherwise.
+ */
+void *
+span_realloc(void *ptr, size_t size, void *(*alloc)(size_t))
+{
+	size_t npages = (size + SPAN_PAGESIZE - 1) >> SPAN_PAGESHIFT;
+	struct span *next, *sp;
+	char *end;
+	void *newptr;
+
+	if (size == 0) {
+		span_free(ptr);
+		return (NULL);
+	} else if (ptr == NULL)
+		return (span_malloc(size));
+
+	sp = pm_get(ptr);
+	if (npages <= sp->npages) {
+		carve(sp, npages);
+		return (ptr);
+	}
+
+	// Absorb the free span above, or the pages above the tier's end.
+	end = sp->start + (sp->npages << SPAN_PAGESHIFT);
+	if (npages <= SPAN_LISTS && end < span_base + span_extent &&
+	    (next = pm_get(end))->free &&
+	    sp->npages + next->npages >= npages) {
+		pop_free(next);
+		sp->npages += next->npages;
+		next->next = spare;
+		spare = next;
+		map_span(sp);
+		carve(sp, npages);
+		return (ptr);
+	}
+	if (npages <= SPAN_LISTS && end == span_base + span_extent &&
+	    mem_region_sbrk(pages, (npages - sp->npages) << SPAN_PAGESHIFT) !=
+	    (void *)-1) {
+		span_extent += (npages - sp->npages) << SPAN_PAGESHIFT;
+		sp->npages = npages;
+		map_span(sp);
+		return (ptr);
+	}
+
+	if ((newptr = alloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, sp->npages << SPAN_PAGESHIFT);
+	span_free(ptr);
+	return (newptr);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns a free span of at least "npages" pages, removed from its free
+ *   list, after growing the tier if no free span is long enough.  Returns
+ *   NULL if the tier could not grow.
+ */
+static struct span *
+find_span(size_t npages)
+{
+	struct span *sp = NULL;
+	size_t grow, k = npages - 1, w;
+	uint64_t bits;
+	char *end;
+
+	// Find the shortest nonempty list of spans that are long enough.
+	for (w = k / 64; w < SPAN_LISTS / 64; w++) {
+		bits = nonempty[w];
+		if (w == k / 64)
+			bits &= ~(uint64_t)0 << (k % 64);
+		if (bits != 0) {
+			sp = free_spans[w * 64 + __builtin_ctzll(bits)];
+			pop_free(sp);
+			return (sp);
+		}
+	}
+
+	// Grow the tier, extending a free span that ends it.
+	end = span_base + span_extent;
+	if (span_extent > 0 && (sp = pm_get(end - SPAN_PAGESIZE))->free)
+		pop_free(sp);
+	else
+		sp = NULL;
+	grow = npages - (sp != NULL ? sp->npages : 0);
+	if (mem_region_sbrk(pages, grow << SPAN_PAGESHIFT) == (void *)-1) {
+		if (sp != NULL)
+			push_free(sp);
+		return (NULL);
+	}
+	span_extent += grow << SPAN_PAGESHIFT;
+	if (sp == NULL) {
+		if ((sp = new_span(end, npages)) == NULL)
+			return (NULL);
+	} else
+		sp->npages = npages;
+	map_span(sp);
+	return (sp);
+}
+
+/*
+ * Requires:
+ *   "sp" is a span, not on a free list, of at least "npages" pages.
+ *
+ * Effects:
+ *   Make "sp" an allocated span of exactly "npages" pages, returning its
+ *   remaining pages to the free lists.
+ */
+static void
+carve(struct span *sp, size_t npages)
+{
+	struct span *rest;
+
+	sp->free = false;
+	if (sp->npages == npages)
+		return;
+	if ((rest = new_span(sp->start + (npages << SPAN_PAGESHIFT),
+	    sp->npages - npages)) == NULL)
+		return;
+	sp->npages = npages;
+	map_span(sp);
+	map_span(rest);
+	// span_free merges the remainder with a free span above it.
+	rest->free = false;
+	span_free(rest->start);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns a new allocated span descriptor for the "npages" pages at
+ *   "start", which is not yet mapped, or NULL if the metadata region is
+ *   exhausted.
+ */
+static struct span *
+new_span(char *start, size_t npages)
+{
+	struct span *sp;
+
+	if ((sp = spare) != NULL)
+		spare = sp->next;
+	else if ((sp = mem_region_sbrk(meta, sizeof(struct span))) ==
+	    (void *)-1)
+		return (NULL);
+	sp->start = start;
+	sp->npages = npages;
+	sp->free = false;
+	sp->prev = sp->next = NULL;
+	return (sp);
+}
+
+/*
+ * Requires:
+ *   "sp" is a span.
+ *
+ * Effects:
+ *   Map the first and last pages of "sp" to "sp" in the pagemap.
+ */
+static void
+map_span(struct span *sp)
+{
+
+	// The metadata region is sized for every leaf that the tier can
+	// need, so pm_set cannot fail here.
+	pm_set(sp->start, sp);
+	pm_set(sp->start + ((sp->npages - 1) << SPAN_PAGESHIFT), sp);
+}
+
+/*
+ * Requires:
+ *   "p" is in a page of the tier that has been mapped.
+ *
+ * Effects:
+ *   Returns the span that the page of "p" is mapped to.
+ */
+static struct span *
+pm_get(char *p)
+{
+	size_t pn = PAGE_NUM(p);
+
+	return (pm_root[pn >> PM_LEAFBITS]->spans[pn & (PM_LEAFSIZE - 1)]);
+}
+
+/*
+ * Requires:
+ *   "p" is in a page of the tier.
+ *
+ * Effects:
+ *   Map the page of "p" to "sp", creating its leaf if needed.  Returns
+ *   false if the leaf could not be created.
+ */
+static bool
+pm_set(char *p, struct span *sp)
+{
+	size_t pn = PAGE_NUM(p);
+	struct pm_leaf *leaf = pm_root[pn >> PM_LEAFBITS];
+
+	if (leaf == NULL) {
+		if ((leaf = mem_region_sbrk(meta, sizeof(struct pm_leaf))) ==
+		    (void *)-1)
+			return (false);
+		memset(leaf, 0, sizeof(struct pm_leaf));
+		pm_root[pn >> PM_LEAFBITS] = leaf;
+	}
+	leaf->spans[pn & (PM_LEAFSIZE - 1)] = sp;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "sp" is a span that is not on a free list.
+ *
+ * Effects:
+ *   Mark "sp" free and push it on the free list for its length.
+ */
+static void
+push_free(struct span *sp)
+{
+	size_t k = (sp->npages < SPAN_LISTS ? sp->npages : SPAN_LISTS) - 1;
+
+	sp->free = true;
+	sp->prev = NULL;
+	sp->next = free_spans[k];
+	if (sp->next != NULL)
+		sp->next->prev = sp;
+	free_spans[k] = sp;
+	nonempty[k / 64] |= (uint64_t)1 << (k % 64);
+}
+
+/*
+ * Requires:
+ *   "sp" is a free span.
+ *
+ * Effects:
+ *   Remove "sp" from its free list and mark it allocated.
+ */
+static void
+pop_free(struct span *sp)
+{
+	size_t k = (sp->npages < SPAN_LISTS ? sp->npages : SPAN_LISTS) - 1;
+
+	sp->free = false;
+	if (sp->prev != NULL)
+		sp->prev->next = sp->next;
+	else
+		free_spans[k] = sp->next;
+	if (sp->next != NULL)
+		sp->next->prev = sp->prev;
+	if (free_spans[k] == NULL)
+		nonempty[k / 64] &= ~((uint64_t)1 << (k % 64));
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
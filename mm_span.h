@@ -0,0 +1,15 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * A page-span tier for medium requests, used by mm_malloc when enabled.
+ */
+
+#define SPAN_MINSIZE  (1 << 12)  // Smallest request served (bytes)
+#define SPAN_MAXSIZE  (1 << 20)  // Largest request served (bytes)
+
+int span_init(void);
+void span_deinit(void);
+int span_owns(void *ptr);
+size_t span_size(void *ptr);
+void *span_malloc(size_t size);
+void span_free(void *ptr);
+void *span_realloc(void *ptr, size_t size, void *(*alloc)(size_t));
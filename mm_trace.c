@@ -0,0 +1,218 @@
+/*
+ * Per-thread event rings for mm_malloc, mm_free and mm_realloc.  Each
+ * thread maps a ring of MM_TRACE_EVENTS events on its first traced call
+ * and overwrites its oldest event once the ring is full, so recording an
+ * event takes no lock and no system call.  The rings are mapped directly
+ * rather than allocated, so that tracing also works where mm_malloc is
+ * the process's malloc, and they outlive their threads, so that a dump
+ * at exit still holds the events of the threads that have finished.
+ *
+ * mm_trace_dump reads the rings of running threads without stopping
+ * them, so a dump taken while other threads call the allocator may hold
+ * a few torn events at the newest end of their rings.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "mm_trace.h"
+#include "mm_write.h"
+
+#if defined(MM_TRACE)
+struct trace_ring {
+	struct trace_ring *next;  // Next ring of any thread
+	unsigned tid;             // Thread that records the ring
+	uint64_t count;           // Events recorded so far
+	struct mm_trace_event events[MM_TRACE_EVENTS];
+};
+
+/* Global variables: */
+__thread struct trace_call trace_call;
+static __thread struct trace_ring *trace_ring;  // This thread's ring
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *trace_rings;          // Every ring
+
+/* Function prototypes for internal helper routines: */
+static struct trace_ring *ring_create(void);
+static uint64_t now_cycles(void);
+
+/*
+ * Requires:
+ *   No call is in progress on this thread.
+ *
+ * Effects:
+ *   Start recording a call.
+ */
+void
+trace_begin(void)
+{
+
+	trace_call.visited = 0;
+	trace_call.flags = 0;
+	trace_call.start = now_cycles();
+}
+
+/*
+ * Requires:
+ *   The call started by trace_begin has just finished.
+ *
+ * Effects:
+ *   Record the call in this thread's ring, unless the ring could not be
+ *   mapped.
+ */
+void
+trace_end(unsigned op, size_t size, void *addr, void *old)
+{
+	struct trace_ring *ring = trace_ring;
+	struct mm_trace_event *ev;
+	uint64_t end = now_cycles();
+
+	if (ring == NULL && (ring = ring_create()) == NULL)
+		return;
+	ev = &ring->events[ring->count % MM_TRACE_EVENTS];
+	ev->tsc = trace_call.start;
+	ev->addr = (uintptr_t)addr;
+	ev->old = (uintptr_t)old;
+	ev->size = size;
+	ev->cycles = end - trace_call.start;
+	ev->visited = trace_call.visited;
+	ev->op = op;
+	ev->flags = trace_call.flags;
+	__atomic_store_n(&ring->count, ring->count + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Write every ring to the file "path", which is created or truncated.
+ *   Returns 0 if the rings were written and -1 otherwise.
+ */
+int
+mm_trace_dump(const char *path)
+{
+#if defined(MM_TRACE)
+	struct mm_trace_header hdr;
+	struct mm_trace_ring rh;
+	struct trace_ring *ring;
+	uint64_t count, first;
+	int fd, ret = 0;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return (-1);
+	pthread_mutex_lock(&trace_mutex);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MM_TRACE_MAGIC;
+	hdr.version = MM_TRACE_VERSION;
+	hdr.event_size = sizeof(struct mm_trace_event);
+	for (ring = trace_rings; ring != NULL; ring = ring->next)
+		hdr.rings++;
+	if (write_all(fd, &hdr, sizeof(hdr)) == -1)
+		ret = -1;
+
+	// Write the events of each ring oldest first, in at most two pieces
+	// when the ring has wrapped.
+	for (ring = trace_rings; ring != NULL && ret == 0; ring = ring->next) {
+		count = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+		memset(&rh, 0, sizeof(rh));
+		rh.tid = ring->tid;
+		rh.events = count < MM_TRACE_EVENTS ? count : MM_TRACE_EVENTS;
+		rh.dropped = count - rh.events;
+		first = count % MM_TRACE_EVENTS;
+		if (write_all(fd, &rh, sizeof(rh)) == -1 ||
+		    (rh.dropped > 0 && write_all(fd, &ring->events[first],
+		    (MM_TRACE_EVENTS - first) * sizeof(ring->events[0])) ==
+		    -1) ||
+		    write_all(fd, ring->events, (rh.dropped > 0 ? first :
+		    count) * sizeof(ring->events[0])) == -1)
+			ret = -1;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	if (close(fd) == -1)
+		ret = -1;
+	return (ret);
+#else
+	(void)path;
+	errno = ENOTSUP;
+	return (-1);
+#endif
+}
+
+#if defined(MM_TRACE)
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   This thread has no ring.
+ *
+ * Effects:
+ *   Map a ring for this thread and link it into the list of every ring.
+ *   Returns the ring or NULL if it could not be mapped.
+ */
+static struct trace_ring *
+ring_create(void)
+{
+	struct trace_ring *ring;
+
+	if ((ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return (NULL);
+	ring->tid = syscall(SYS_gettid);
+	pthread_mutex_lock(&trace_mutex);
+	ring->next = trace_rings;
+	trace_rings = ring;
+	pthread_mutex_unlock(&trace_mutex);
+	trace_ring = ring;
+	return (ring);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the time stamp counter on x86, and nanoseconds elsewhere.
+ */
+static uint64_t
+now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__builtin_ia32_rdtsc());
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif
+}
+#endif
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,38 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * Per-thread event rings, recorded by mm_malloc, mm_free and mm_realloc
+ * when compiled with -DMM_TRACE.  Otherwise the macros below expand to
+ * nothing.
+ */
+
+#if defined(MM_TRACE)
+// The call in progress on this thread.  Calls nested in another, such as
+// the mm_malloc of a moving mm_realloc, are part of the outer one.
+struct trace_call {
+	uint64_t start;     // Cycle counter at the start of the call
+	unsigned visited;   // Free blocks examined so far
+	unsigned flags;     // MM_TRACE_COALESCED and MM_TRACE_EXTENDED
+	unsigned depth;     // Number of calls in progress
+};
+
+extern __thread struct trace_call trace_call;
+
+void trace_begin(void);
+void trace_end(unsigned op, size_t size, void *addr, void *old);
+
+#define TRACE_BEGIN()  do {						\
+	if (trace_call.depth++ == 0)					\
+		trace_begin();						\
+} while (0)
+#define TRACE_END(op, size, addr, old)  do {				\
+	if (--trace_call.depth == 0)					\
+		trace_end((op), (size), (addr), (old));			\
+} while (0)
+#define TRACE_VISIT()     (trace_call.visited++)
+#define TRACE_FLAG(flag)  (trace_call.flags |= (flag))
+#else
+#define TRACE_BEGIN()                   do { } while (0)
+#define TRACE_END(op, size, addr, old)  do { } while (0)
+#define TRACE_VISIT()                   do { } while (0)
+#define TRACE_FLAG(flag)                do { } while (0)
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Writing whole buffers to files.  The heap snapshots, the heap profile
+ * and the event rings are all written with write(2) rather than stdio,
+ * since they may be dumped where mm_malloc is the process's malloc.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "mm_write.h"
+
+/*
+ * Requires:
+ *   "fd" is open for writing.
+ *
+ * Effects:
+ *   Write the "len" bytes at "buf" to "fd", resuming after short writes.
+ *   Returns 0 if they were written and -1 otherwise.
+ */
+int
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
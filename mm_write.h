@@ -0,0 +1,7 @@
+/*- -*- mode: c; c-basic-offset: 8; -*-
+ *
+ * Writing whole buffers to files, for the dumps of mm.c, mm_profile.c and
+ * mm_trace.c.
+ */
+
+int write_all(int fd, const void *buf, size_t len);
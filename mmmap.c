@@ -0,0 +1,517 @@
+/*
+ * mmmap - Render the heap snapshots that mm_heap_snapshot writes as maps
+ * of the heap.
+ *
+ * Each pixel stands for a fixed number of bytes of a heap's region and
+ * takes the color of whatever covers most of them: allocated blocks, free
+ * blocks, or the heap's own metadata, such as its prologue and epilogue.
+ * Bytes past the end of a region are black, and each heap starts on a row
+ * of its own.  By default every snapshot becomes a PPM image next to it,
+ * laid out for the largest region of any snapshot given, so that the
+ * snapshots that "mdriver -A" takes during a replay are the frames of an
+ * animation.  With -s, the snapshots become the columns of a single SVG
+ * timeline instead.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+#define MAP_HEAPS   2    // Most heaps in a snapshot
+#define MAP_WIDTH   256  // Default pixels per row
+#define MAP_BYTES   64   // Default bytes per pixel
+#define SVG_HEIGHT  512  // Pixel rows of the timeline
+#define SVG_COLUMN  4    // Width of a snapshot's column in the timeline
+
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
+
+enum { KIND_UNUSED, KIND_META, KIND_FREE, KIND_ALLOC, KINDS };
+
+struct snapshot {
+	const char *path;
+	unsigned heaps;
+	struct mm_snapshot_heap heap[MAP_HEAPS];
+	unsigned long *words[MAP_HEAPS];  // Block headers of each heap
+};
+
+// Where each heap starts, in pixels, and how many bytes a pixel stands for.
+struct layout {
+	unsigned long bpp;              // Bytes per pixel
+	unsigned width;                 // Pixels per row
+	unsigned long start[MAP_HEAPS]; // First pixel of each heap
+	unsigned long npixels;          // Pixels in all, in whole rows
+};
+
+struct pixel {
+	unsigned long bytes[KINDS];     // Bytes of each kind in the pixel
+	unsigned long best;             // Most bytes of one allocated block
+	unsigned cls;                   // Size class of that block
+};
+
+/* Function prototypes for internal helper routines: */
+static int read_snapshot(const char *path, struct snapshot *snap);
+static void make_layout(struct snapshot *snaps, int n, struct layout *lay);
+static void render(const struct snapshot *snap, const struct layout *lay,
+    struct pixel *pixels);
+static void paint(struct pixel *pixels, unsigned long bpp, unsigned long lo,
+    unsigned long hi, int kind, unsigned cls);
+static void color(const struct pixel *px, int classes, unsigned char *rgb);
+static int write_ppm(const struct snapshot *snap, const struct layout *lay,
+    struct pixel *pixels, int classes);
+static int write_svg(const char *path, struct snapshot *snaps, int n,
+    int classes);
+static void usage(void);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Render the snapshots named on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	struct snapshot *snaps;
+	struct layout lay;
+	struct pixel *pixels;
+	const char *svg = NULL;
+	int c, classes = 0, i, n;
+	long bpp = MAP_BYTES, width = MAP_WIDTH;
+
+	while ((c = getopt(argc, argv, "b:chs:w:")) != -1) {
+		switch (c) {
+		case 'b': // Bytes per pixel
+			if ((bpp = atol(optarg)) <= 0) {
+				usage();
+				return (1);
+			}
+			break;
+		case 'c': // Color allocated blocks by size class
+			classes = 1;
+			break;
+		case 's': // Write an SVG timeline
+			svg = optarg;
+			break;
+		case 'w': // Pixels per row
+			if ((width = atol(optarg)) <= 0) {
+				usage();
+				return (1);
+			}
+			break;
+		case 'h':
+			usage();
+			return (0);
+		default:
+			usage();
+			return (1);
+		}
+	}
+	if (optind == argc) {
+		usage();
+		return (1);
+	}
+
+	n = argc - optind;
+	if ((snaps = calloc(n, sizeof(*snaps))) == NULL) {
+		fprintf(stderr, "mmmap: out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < n; i++) {
+		if (read_snapshot(argv[optind + i], &snaps[i]) == -1)
+			return (1);
+	}
+	if (svg != NULL)
+		return (write_svg(svg, snaps, n, classes) == -1);
+
+	lay.bpp = bpp;
+	lay.width = width;
+	make_layout(snaps, n, &lay);
+	if ((pixels = malloc(lay.npixels * sizeof(*pixels))) == NULL) {
+		fprintf(stderr, "mmmap: out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < n; i++) {
+		render(&snaps[i], &lay, pixels);
+		if (write_ppm(&snaps[i], &lay, pixels, classes) == -1)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Read the snapshot in the file "path" into "snap".  Returns 0 if it was
+ *   read and -1, after printing why, otherwise.
+ */
+static int
+read_snapshot(const char *path, struct snapshot *snap)
+{
+	struct mm_snapshot_header hdr;
+	struct mm_snapshot_heap *sh;
+	unsigned long extent, j;
+	unsigned h;
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "mmmap: %s: %s\n", path, strerror(errno));
+		return (-1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != MM_SNAPSHOT_MAGIC ||
+	    hdr.version != MM_SNAPSHOT_VERSION ||
+	    hdr.word_size != sizeof(unsigned long) || hdr.heaps > MAP_HEAPS) {
+		fprintf(stderr, "mmmap: %s: not a version %d snapshot\n",
+		    path, MM_SNAPSHOT_VERSION);
+		fclose(fp);
+		return (-1);
+	}
+	snap->path = path;
+	snap->heaps = hdr.heaps;
+	for (h = 0; h < hdr.heaps; h++) {
+		sh = &snap->heap[h];
+		if (fread(sh, sizeof(*sh), 1, fp) != 1 ||
+		    (snap->words[h] = malloc(MAX(sh->blocks, 1) *
+		    sizeof(unsigned long))) == NULL ||
+		    fread(snap->words[h], sizeof(unsigned long), sh->blocks,
+		    fp) != sh->blocks)
+			goto truncated;
+
+		// The blocks must fit in the region.
+		extent = sh->first;
+		for (j = 0; j < sh->blocks; j++)
+			extent += snap->words[h][j] & ~15UL;
+		if (extent > sh->size)
+			goto truncated;
+	}
+	fclose(fp);
+	return (0);
+
+truncated:
+	fprintf(stderr, "mmmap: %s: truncated or corrupt\n", path);
+	fclose(fp);
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   "lay->bpp" and "lay->width" are set.
+ *
+ * Effects:
+ *   Lay the heaps out in rows of "lay->width" pixels, each heap after a
+ *   blank row, with room for its largest region in any of the "n"
+ *   snapshots.
+ */
+static void
+make_layout(struct snapshot *snaps, int n, struct layout *lay)
+{
+	unsigned long end = 0, size;
+	unsigned h;
+	int i;
+
+	for (h = 0; h < MAP_HEAPS; h++) {
+		size = 0;
+		for (i = 0; i < n; i++) {
+			if (h < snaps[i].heaps)
+				size = MAX(size, snaps[i].heap[h].size);
+		}
+		if (h > 0 && size > 0)
+			end += lay->width;
+		lay->start[h] = end;
+		end += (size + lay->bpp - 1) / lay->bpp;
+		end = (end + lay->width - 1) / lay->width * lay->width;
+	}
+	lay->npixels = MAX(end, lay->width);
+}
+
+/*
+ * Requires:
+ *   "pixels" has room for "lay->npixels" pixels.
+ *
+ * Effects:
+ *   Sum the bytes of each kind in each pixel of the map of "snap".
+ */
+static void
+render(const struct snapshot *snap, const struct layout *lay,
+    struct pixel *pixels)
+{
+	const struct mm_snapshot_heap *sh;
+	struct pixel *base;
+	unsigned long j, off, size, cls;
+	unsigned h;
+
+	memset(pixels, 0, lay->npixels * sizeof(*pixels));
+	for (h = 0; h < snap->heaps; h++) {
+		sh = &snap->heap[h];
+		base = &pixels[lay->start[h]];
+
+		// The blocks lie between the prologue and the epilogue.
+		paint(base, lay->bpp, 0, sh->first, KIND_META, 0);
+		off = sh->first;
+		for (j = 0; j < sh->blocks; j++) {
+			size = snap->words[h][j] & ~15UL;
+			for (cls = 0; cls < MM_STATS_CLASSES - 1 &&
+			    size >= 64UL << cls; cls++)
+				;
+			paint(base, lay->bpp, off, off + size,
+			    (snap->words[h][j] & 1) ? KIND_ALLOC : KIND_FREE,
+			    cls);
+			off += size;
+		}
+		paint(base, lay->bpp, off, sh->size, KIND_META, 0);
+	}
+}
+
+/*
+ * Requires:
+ *   "pixels" covers the bytes from "lo" up to "hi".
+ *
+ * Effects:
+ *   Add the bytes from "lo" up to "hi", of kind "kind" and, if they are
+ *   one allocated block, of size class "cls", to the pixels they fall in.
+ */
+static void
+paint(struct pixel *pixels, unsigned long bpp, unsigned long lo,
+    unsigned long hi, int kind, unsigned cls)
+{
+	struct pixel *px;
+	unsigned long n, p;
+
+	for (p = lo / bpp; p * bpp < hi; p++) {
+		px = &pixels[p];
+		n = MIN(hi, (p + 1) * bpp) - MAX(lo, p * bpp);
+		px->bytes[kind] += n;
+		if (kind == KIND_ALLOC && n > px->best) {
+			px->best = n;
+			px->cls = cls;
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "rgb" has room for three bytes.
+ *
+ * Effects:
+ *   Store the color of the kind with the most bytes in "px" in "rgb".
+ *   Allocated blocks are blue, or with "classes", a hue by size class from
+ *   red for the smallest to violet for the largest.
+ */
+static void
+color(const struct pixel *px, int classes, unsigned char *rgb)
+{
+	static const unsigned char kinds[KINDS][3] = {
+		{ 0, 0, 0 },        // Unused
+		{ 230, 140, 30 },   // Metadata
+		{ 235, 235, 235 },  // Free
+		{ 40, 90, 200 },    // Allocated
+	};
+	double f;
+	int k, kind = KIND_UNUSED, sector;
+
+	for (k = KIND_META; k < KINDS; k++) {
+		if (px->bytes[k] > px->bytes[kind])
+			kind = k;
+	}
+	memcpy(rgb, kinds[kind], 3);
+	if (kind != KIND_ALLOC || !classes)
+		return;
+
+	// A hue at the class's share of the way around five sixths of the
+	// color wheel, at full saturation and 80% value.
+	f = 5.0 * px->cls / (MM_STATS_CLASSES - 1);
+	sector = (int)f;
+	f -= sector;
+	switch (sector) {
+	case 0:
+		rgb[0] = 204; rgb[1] = 204 * f; rgb[2] = 0;
+		break;
+	case 1:
+		rgb[0] = 204 * (1 - f); rgb[1] = 204; rgb[2] = 0;
+		break;
+	case 2:
+		rgb[0] = 0; rgb[1] = 204; rgb[2] = 204 * f;
+		break;
+	case 3:
+		rgb[0] = 0; rgb[1] = 204 * (1 - f); rgb[2] = 204;
+		break;
+	default:
+		rgb[0] = 204 * f; rgb[1] = 0; rgb[2] = 204;
+		break;
+	}
+}
+
+/*
+ * Requires:
+ *   "pixels" holds the map of "snap" as laid out by "lay".
+ *
+ * Effects:
+ *   Write the map as a PPM image named after the snapshot, with ".ppm" in
+ *   place of any ".snap".  Returns 0 if it was written and -1, after
+ *   printing why, otherwise.
+ */
+static int
+write_ppm(const struct snapshot *snap, const struct layout *lay,
+    struct pixel *pixels, int classes)
+{
+	unsigned char rgb[3];
+	size_t len = strlen(snap->path);
+	unsigned long p;
+	char *path;
+	FILE *fp;
+
+	if ((path = malloc(len + sizeof(".ppm"))) == NULL) {
+		fprintf(stderr, "mmmap: out of memory\n");
+		return (-1);
+	}
+	strcpy(path, snap->path);
+	if (len > 5 && strcmp(path + len - 5, ".snap") == 0)
+		len -= 5;
+	strcpy(path + len, ".ppm");
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "mmmap: %s: %s\n", path, strerror(errno));
+		free(path);
+		return (-1);
+	}
+	fprintf(fp, "P6\n%u %lu\n255\n", lay->width, lay->npixels /
+	    lay->width);
+	for (p = 0; p < lay->npixels; p++) {
+		color(&pixels[p], classes, rgb);
+		fwrite(rgb, 3, 1, fp);
+	}
+	if (fclose(fp) == EOF) {
+		fprintf(stderr, "mmmap: %s: %s\n", path, strerror(errno));
+		free(path);
+		return (-1);
+	}
+	free(path);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Write the "n" snapshots to the file "path" as an SVG timeline, one
+ *   column of SVG_HEIGHT pixels per snapshot, with the runs of pixels of
+ *   one color as rectangles.  Returns 0 if it was written and -1, after
+ *   printing why, otherwise.
+ */
+static int
+write_svg(const char *path, struct snapshot *snaps, int n, int classes)
+{
+	struct layout lay;
+	struct pixel *pixels;
+	unsigned char rgb[3], run[3];
+	unsigned long p, size, top, total = 0;
+	unsigned h;
+	FILE *fp;
+	int i;
+
+	// One pixel per row, sized so that the largest regions fit.
+	for (h = 0; h < MAP_HEAPS; h++) {
+		size = 0;
+		for (i = 0; i < n; i++) {
+			if (h < snaps[i].heaps)
+				size = MAX(size, snaps[i].heap[h].size);
+		}
+		total += size;
+	}
+	lay.width = 1;
+	lay.bpp = MAX(1, (total + SVG_HEIGHT - 1) / SVG_HEIGHT);
+	make_layout(snaps, n, &lay);
+	if ((pixels = malloc(lay.npixels * sizeof(*pixels))) == NULL) {
+		fprintf(stderr, "mmmap: out of memory\n");
+		return (-1);
+	}
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "mmmap: %s: %s\n", path, strerror(errno));
+		free(pixels);
+		return (-1);
+	}
+	fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+	    "width=\"%d\" height=\"%lu\">\n", n * SVG_COLUMN, lay.npixels);
+	fprintf(fp, "<rect width=\"100%%\" height=\"100%%\" fill=\"#000\"/>\n");
+	for (i = 0; i < n; i++) {
+		render(&snaps[i], &lay, pixels);
+		fprintf(fp, "<g><title>%s</title>\n", snaps[i].path);
+		color(&pixels[0], classes, run);
+		for (top = 0, p = 1; p <= lay.npixels; p++) {
+			if (p < lay.npixels) {
+				color(&pixels[p], classes, rgb);
+				if (memcmp(rgb, run, 3) == 0)
+					continue;
+			}
+			if (memcmp(run, "\0\0\0", 3) != 0)
+				fprintf(fp, "<rect x=\"%d\" y=\"%lu\" "
+				    "width=\"%d\" height=\"%lu\" "
+				    "fill=\"#%02x%02x%02x\"/>\n",
+				    i * SVG_COLUMN, top, SVG_COLUMN, p - top,
+				    run[0], run[1], run[2]);
+			memcpy(run, rgb, 3);
+			top = p;
+		}
+		fprintf(fp, "</g>\n");
+	}
+	fprintf(fp, "</svg>\n");
+	free(pixels);
+	if (fclose(fp) == EOF) {
+		fprintf(stderr, "mmmap: %s: %s\n", path, strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Print the usage message.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: mmmap [-ch] [-b <bytes>] [-s <file>] "
+	    "[-w <pixels>] <snapshot>...\n");
+	fprintf(stderr, "\t-b <bytes>  Bytes per pixel of the PPM images "
+	    "(default %d).\n", MAP_BYTES);
+	fprintf(stderr, "\t-c          Color allocated blocks by size "
+	    "class.\n");
+	fprintf(stderr, "\t-h          Print this message.\n");
+	fprintf(stderr, "\t-s <file>   Write an SVG timeline of the snapshots "
+	    "to <file>\n\t\t    instead of a PPM image per snapshot.\n");
+	fprintf(stderr, "\t-w <pixels> Pixels per row of the PPM images "
+	    "(default %d).\n", MAP_WIDTH);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,227 @@
+/*
+ * mmstat - Print the statistics that an allocator publishes with
+ * mm_stats_publish, read from the mapped page without any help from the
+ * publishing process.
+ *
+ * Each sample copies the page under its sequence lock: the copy is kept
+ * only if the sequence number was even before it and unchanged after it,
+ * so a sample never mixes two updates.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+#define RETRIES  1000  // Most attempts to copy a consistent sample
+
+/* Function prototypes for internal helper routines: */
+static int sample(const struct mm_stats_page *page,
+    struct mm_stats_page *copy);
+static void print_sample(const struct mm_stats_page *copy, int classes);
+static void usage(void);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Print samples of the page published in the file named on the command
+ *   line.
+ */
+int
+main(int argc, char **argv)
+{
+	struct mm_stats_page copy, *page;
+	struct stat st;
+	struct timespec ts;
+	int c, classes = 0, count = -1, fd, i, interval = 0;
+
+	while ((c = getopt(argc, argv, "ci:n:h")) != -1) {
+		switch (c) {
+		case 'c': // Print the free blocks per size class
+			classes = 1;
+			break;
+		case 'i': // Seconds between samples
+			if ((interval = atoi(optarg)) <= 0) {
+				usage();
+				return (1);
+			}
+			break;
+		case 'n': // Number of samples, or 0 for no limit
+			if ((count = atoi(optarg)) < 0) {
+				usage();
+				return (1);
+			}
+			break;
+		case 'h':
+			usage();
+			return (0);
+		default:
+			usage();
+			return (1);
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		return (1);
+	}
+
+	// Sample once, or with -i until interrupted.
+	if (count == -1)
+		count = (interval > 0) ? 0 : 1;
+
+	if ((fd = open(argv[optind], O_RDONLY)) == -1) {
+		fprintf(stderr, "mmstat: %s: %s\n", argv[optind],
+		    strerror(errno));
+		return (1);
+	}
+	// A file shorter than the page would fault when read.
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*page)) {
+		fprintf(stderr, "mmstat: %s: not a version %d stats page\n",
+		    argv[optind], MM_STATS_VERSION);
+		return (1);
+	}
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		fprintf(stderr, "mmstat: %s: %s\n", argv[optind],
+		    strerror(errno));
+		return (1);
+	}
+	if (page->magic != MM_STATS_MAGIC ||
+	    page->version != MM_STATS_VERSION) {
+		fprintf(stderr, "mmstat: %s: not a version %d stats page\n",
+		    argv[optind], MM_STATS_VERSION);
+		return (1);
+	}
+
+	printf("%8s%10s%10s%10s%10s%6s%10s%10s%10s%7s\n", "pid", "updates",
+	    "heap KB", "live KB", "free KB", "frag", "mallocs", "frees",
+	    "reallocs", "sbrks");
+	ts.tv_sec = interval;
+	ts.tv_nsec = 0;
+	for (i = 0; count == 0 || i < count; i++) {
+		if (i > 0)
+			nanosleep(&ts, NULL);
+		if (sample(page, &copy) == -1) {
+			fprintf(stderr, "mmstat: the page stayed mid-update\n");
+			return (1);
+		}
+		print_sample(&copy, classes);
+		fflush(stdout);
+	}
+	return (0);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "page" is a mapped stats page.
+ *
+ * Effects:
+ *   Copy a consistent sample of "page" into "copy".  Returns 0 if it did
+ *   and -1 if every attempt overlapped an update, as when the publisher
+ *   died in the middle of one.
+ */
+static int
+sample(const struct mm_stats_page *page, struct mm_stats_page *copy)
+{
+	struct timespec ts = { 0, 1000000 };
+	unsigned long seq;
+	int i;
+
+	for (i = 0; i < RETRIES; i++) {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (seq % 2 == 0) {
+			memcpy(copy, page, sizeof(*copy));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) ==
+			    seq)
+				return (0);
+		}
+		nanosleep(&ts, NULL);
+	}
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   "copy" is a consistent sample.
+ *
+ * Effects:
+ *   Print one line for "copy", and its free blocks per size class if
+ *   "classes" is set.  Fragmentation is the share of the free bytes that
+ *   lie outside the largest free block.
+ */
+static void
+print_sample(const struct mm_stats_page *copy, int classes)
+{
+	const struct mm_stats *stats = &copy->stats;
+	double frag = 0;
+	int c;
+
+	if (stats->free > 0)
+		frag = 1.0 - (double)stats->largest_free / stats->free;
+	printf("%8lu%10lu%10lu%10lu%10lu%5.0f%%%10lu%10lu%10lu%7lu\n",
+	    copy->pid, copy->updates, (unsigned long)stats->heap_size / 1024,
+	    (unsigned long)stats->live / 1024,
+	    (unsigned long)stats->free / 1024, 100 * frag, stats->mallocs,
+	    stats->frees, stats->reallocs, stats->sbrks);
+	if (!classes)
+		return;
+	printf("  free blocks by least size:");
+	for (c = 0; c < MM_STATS_CLASSES; c++) {
+		if (stats->free_blocks[c] > 0)
+			printf(" %luB:%lu", 32UL << c, stats->free_blocks[c]);
+	}
+	printf("\n");
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Print the usage message.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: mmstat [-ch] [-i <secs>] [-n <count>] "
+	    "<file>\n");
+	fprintf(stderr, "\t-c         Print the free blocks per size "
+	    "class.\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-i <secs>  Sample every <secs> seconds, until "
+	    "-n samples.\n");
+	fprintf(stderr, "\t-n <count> Print <count> samples, or 0 for no "
+	    "limit.\n");
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,198 @@
+/*
+ * mmtrace - Print the event rings that mm_trace_dump wrote to a file, as
+ * text or as CSV.
+ *
+ * Events are printed ring by ring, oldest first.  Each event's time is
+ * the cycle counter at the start of its call, relative to the earliest
+ * event of any ring, so that the rings of different threads line up.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+/* Function prototypes for internal helper routines: */
+static unsigned long first_tsc(FILE *fp, unsigned rings);
+static void print_event(const struct mm_trace_event *ev, unsigned tid,
+    unsigned long base, int csv);
+static void usage(void);
+
+static const char *op_names[] = { "malloc", "free", "realloc" };
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Print the rings in the file named on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	struct mm_trace_header hdr;
+	struct mm_trace_event ev;
+	struct mm_trace_ring rh;
+	unsigned long base;
+	unsigned i, r;
+	int c, csv = 0;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "ch")) != -1) {
+		switch (c) {
+		case 'c': // Print comma-separated values
+			csv = 1;
+			break;
+		case 'h':
+			usage();
+			return (0);
+		default:
+			usage();
+			return (1);
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		return (1);
+	}
+
+	if ((fp = fopen(argv[optind], "rb")) == NULL) {
+		fprintf(stderr, "mmtrace: %s: %s\n", argv[optind],
+		    strerror(errno));
+		return (1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != MM_TRACE_MAGIC || hdr.version != MM_TRACE_VERSION ||
+	    hdr.event_size != sizeof(ev)) {
+		fprintf(stderr, "mmtrace: %s: not a version %d trace\n",
+		    argv[optind], MM_TRACE_VERSION);
+		return (1);
+	}
+	base = first_tsc(fp, hdr.rings);
+
+	if (csv)
+		printf("tid,cycle,op,size,addr,old,cycles,visited,coalesced,"
+		    "extended\n");
+	for (r = 0; r < hdr.rings; r++) {
+		if (fread(&rh, sizeof(rh), 1, fp) != 1)
+			goto truncated;
+		if (!csv)
+			printf("thread %u: %u events, %lu older events "
+			    "overwritten\n", rh.tid, rh.events, rh.dropped);
+		for (i = 0; i < rh.events; i++) {
+			if (fread(&ev, sizeof(ev), 1, fp) != 1)
+				goto truncated;
+			print_event(&ev, rh.tid, base, csv);
+		}
+	}
+	fclose(fp);
+	return (0);
+
+truncated:
+	fprintf(stderr, "mmtrace: %s: truncated\n", argv[optind]);
+	return (1);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "fp" is positioned at the first of "rings" rings.
+ *
+ * Effects:
+ *   Returns the earliest cycle counter of any event, or 0 if there is
+ *   none, and leaves "fp" where it was.
+ */
+static unsigned long
+first_tsc(FILE *fp, unsigned rings)
+{
+	struct mm_trace_event ev;
+	struct mm_trace_ring rh;
+	unsigned long base = 0;
+	long pos = ftell(fp);
+	unsigned r;
+
+	// The oldest event of each ring is its first.
+	for (r = 0; r < rings; r++) {
+		if (fread(&rh, sizeof(rh), 1, fp) != 1)
+			break;
+		if (rh.events == 0)
+			continue;
+		if (fread(&ev, sizeof(ev), 1, fp) != 1)
+			break;
+		if (base == 0 || ev.tsc < base)
+			base = ev.tsc;
+		if (fseek(fp, (long)(rh.events - 1) * sizeof(ev), SEEK_CUR) ==
+		    -1)
+			break;
+	}
+	fseek(fp, pos, SEEK_SET);
+	return (base);
+}
+
+/*
+ * Requires:
+ *   "ev" was recorded by thread "tid".
+ *
+ * Effects:
+ *   Print "ev" as a line of text or of CSV, with its time relative to
+ *   "base".
+ */
+static void
+print_event(const struct mm_trace_event *ev, unsigned tid,
+    unsigned long base, int csv)
+{
+	const char *op = ev->op < 3 ? op_names[ev->op] : "?";
+
+	if (csv) {
+		printf("%u,%lu,%s,%u,0x%lx,0x%lx,%u,%u,%d,%d\n", tid,
+		    ev->tsc - base, op, ev->size, ev->addr, ev->old,
+		    ev->cycles, ev->visited,
+		    (ev->flags & MM_TRACE_COALESCED) != 0,
+		    (ev->flags & MM_TRACE_EXTENDED) != 0);
+		return;
+	}
+	printf("%14lu %-7s %8u %#14lx", ev->tsc - base, op, ev->size,
+	    ev->addr);
+	if (ev->op == MM_TRACE_REALLOC)
+		printf(" from %#lx", ev->old);
+	printf(" %6u cycles %4u visited%s%s\n", ev->cycles, ev->visited,
+	    (ev->flags & MM_TRACE_COALESCED) ? " coalesced" : "",
+	    (ev->flags & MM_TRACE_EXTENDED) ? " extended" : "");
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Print the usage message.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: mmtrace [-ch] <file>\n");
+	fprintf(stderr, "\t-c         Print comma-separated values.\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
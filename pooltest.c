@@ -0,0 +1,210 @@
+/*
+ * pooltest - Check that pools place every slot where it belongs.
+ *
+ * For each pair of object size and alignment below, including alignments
+ * larger than that of mm_malloc, a pool hands out every slot of several
+ * chunks.  Each object must be aligned, lie within the payload of a
+ * block of the heap, and keep its contents while the others are written.
+ * Once every object is freed, the pool must keep only one spare chunk and
+ * reuse it for the next object.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memlib.h"
+#include "mm.h"
+#include "mm_pool.h"
+
+#define TEST_OBJECTS  2048  // Objects allocated from each pool
+#define TEST_BLOCKS   4096  // Most allocated blocks in the heap
+
+struct pool_case {
+	size_t objsize;
+	size_t align;
+};
+
+// The allocated blocks of the heap, in address order.
+struct blocks {
+	size_t n;
+	char *start[TEST_BLOCKS];  // First byte of each payload
+	char *end[TEST_BLOCKS];    // First byte past it
+};
+
+static const struct pool_case cases[] = {
+	{ 8, 0 }, { 16, 16 }, { 24, 32 }, { 40, 64 }, { 100, 128 },
+	{ 8, 256 }, { 200, 1024 }, { 64, 4096 },
+};
+
+/* Function prototypes for internal helper routines: */
+static int test_pool(const struct pool_case *pc);
+static void add_block(void *ptr, size_t size, int allocated, void *ctx);
+static int in_block(const struct blocks *blocks, char *obj, size_t size);
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Run every case.  Returns 0 if all of them passed and 1 otherwise.
+ */
+int
+main(void)
+{
+	unsigned i;
+	int failed = 0;
+
+	mem_init();
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		failed |= test_pool(&cases[i]);
+	if (!failed)
+		printf("pooltest: ok\n");
+	return (failed);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate TEST_OBJECTS objects from a new pool for "pc" on a fresh
+ *   heap and check them.  Returns 0 if they passed and 1, after printing
+ *   why, otherwise.
+ */
+static int
+test_pool(const struct pool_case *pc)
+{
+	static struct blocks blocks;
+	static char *objs[TEST_OBJECTS];
+	size_t align = pc->align != 0 ? pc->align : sizeof(void *);
+	size_t base;
+	mm_pool_t *pool;
+	unsigned i, j;
+
+	if (mm_init() == -1) {
+		fprintf(stderr, "pooltest: cannot initialize the heap\n");
+		return (1);
+	}
+	blocks.n = 0;
+	mm_heap_walk(add_block, &blocks);
+	base = blocks.n;
+	if ((pool = mm_pool_create(pc->objsize, pc->align)) == NULL) {
+		fprintf(stderr, "pooltest: cannot create a pool\n");
+		return (1);
+	}
+	for (i = 0; i < TEST_OBJECTS; i++) {
+		if ((objs[i] = mm_pool_alloc(pool)) == NULL) {
+			fprintf(stderr, "pooltest: out of memory\n");
+			return (1);
+		}
+		memset(objs[i], i & 0xff, pc->objsize);
+	}
+
+	blocks.n = 0;
+	mm_heap_walk(add_block, &blocks);
+	for (i = 0; i < TEST_OBJECTS; i++) {
+		if ((uintptr_t)objs[i] % align != 0 ||
+		    !in_block(&blocks, objs[i], pc->objsize)) {
+			fprintf(stderr, "pooltest: object %p of size %zu and "
+			    "alignment %zu is misplaced\n", objs[i],
+			    pc->objsize, align);
+			return (1);
+		}
+		for (j = 0; j < pc->objsize; j++) {
+			if ((unsigned char)objs[i][j] != (i & 0xff)) {
+				fprintf(stderr, "pooltest: object %p of size "
+				    "%zu was overwritten\n", objs[i],
+				    pc->objsize);
+				return (1);
+			}
+		}
+	}
+	for (i = 0; i < TEST_OBJECTS; i++)
+		mm_pool_free(pool, objs[i]);
+
+	// Only the pool, its chunk array, and the spare chunk are left, and
+	// the next object comes from the spare.
+	blocks.n = 0;
+	mm_heap_walk(add_block, &blocks);
+	if (blocks.n != base + 3) {
+		fprintf(stderr, "pooltest: %zu blocks remain after freeing "
+		    "every object of size %zu, not 3\n", blocks.n - base,
+		    pc->objsize);
+		return (1);
+	}
+	objs[0] = mm_pool_alloc(pool);
+	blocks.n = 0;
+	mm_heap_walk(add_block, &blocks);
+	if (objs[0] == NULL || blocks.n != base + 3) {
+		fprintf(stderr, "pooltest: the spare chunk of the pool of "
+		    "size %zu was not reused\n", pc->objsize);
+		return (1);
+	}
+	mm_pool_free(pool, objs[0]);
+	mm_pool_destroy(pool);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "ctx" is a struct blocks.
+ *
+ * Effects:
+ *   The mm_heap_walk callback: record the payload of each allocated block.
+ */
+static void
+add_block(void *ptr, size_t size, int allocated, void *ctx)
+{
+	struct blocks *blocks = ctx;
+
+	if (!allocated || blocks->n == TEST_BLOCKS)
+		return;
+	blocks->start[blocks->n] = ptr;
+	blocks->end[blocks->n] = (char *)ptr + size - 2 * sizeof(void *);
+	blocks->n++;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns 1 if the "size" bytes at "obj" lie within the payload of one
+ *   of "blocks" and 0 otherwise.
+ */
+static int
+in_block(const struct blocks *blocks, char *obj, size_t size)
+{
+	size_t lo = 0, hi = blocks->n, mid;
+
+	// Find the last block that starts at or below "obj".
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (blocks->start[mid] <= obj)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0 && obj + size <= blocks->end[lo - 1]);
+}
+
+/*
+ * The last lines of this file configure the behavior of the "Tab" key in
+ * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
+ * particular, depressing the "Tab" key once at the start of a new line will
+ * insert as many tabs and/or spaces as are needed for proper indentation.
+ */
+
+/* Local Variables: */
+/* mode: c */
+/* c-default-style: "bsd" */
+/* c-basic-offset: 8 */
+/* c-continued-statement-offset: 4 */
+/* indent-tabs-mode: t */
+/* End: */
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# gen.py - Generate the synthetic tracefiles in this directory.
+#
+# The traces are written next to this script, so running
+# "python3 traces/gen.py" recreates them byte for byte.  Every
+# generator seeds the random module itself, so the traces do not
+# depend on each other or on the order they are written in.
+#
+# A tracefile is a header of four lines (suggested heap size, number
+# of block ids, number of ops, weight) followed by one op per line:
+# "a id size", "r id size", "f id", and for region traces "n id size"
+# (allocate from the region) and "x" (reset the region).
+#
+
+import os
+import random
+
+DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def emit(name, ops, nids):
+    with open(os.path.join(DIR, name), 'w') as f:
+        f.write("20000\n%d\n%d\n1\n" % (nids, len(ops)))
+        for o in ops:
+            f.write(o + "\n")
+
+
+def rnd(name, n, seed, maxsz=4000):
+    """Random mallocs and frees of 1 to maxsz bytes."""
+    random.seed(seed)
+    live = {}
+    ops = []
+    nid = 0
+    while len(ops) < n:
+        r = random.random()
+        if live and r < 0.4:
+            k = random.choice(list(live))
+            ops.append("f %d" % k)
+            del live[k]
+        else:
+            s = random.randint(1, maxsz)
+            ops.append("a %d %d" % (nid, s))
+            live[nid] = s
+            nid += 1
+    for k in list(live):
+        ops.append("f %d" % k)
+    emit(name, ops, nid)
+
+
+def binary(name, n, small, large):
+    """Pairs of small and large blocks; the large ones are freed and
+    replaced by slightly larger ones that do not fit the holes."""
+    ops = []
+    nid = 0
+    for i in range(n):
+        ops.append("a %d %d" % (nid, small))
+        ops.append("a %d %d" % (nid + 1, large))
+        nid += 2
+    for i in range(n):
+        ops.append("f %d" % (2 * i + 1))
+    for i in range(n):
+        ops.append("a %d %d" % (nid, small + large))
+        nid += 1
+    for k in range(nid):
+        if k % 2 == 0 or k >= 2 * n:
+            ops.append("f %d" % k)
+    emit(name, ops, nid)
+
+
+def coalescing(name, n):
+    """Two neighbouring blocks freed and reallocated as one."""
+    ops = []
+    nid = 0
+    for i in range(n):
+        ops += ["a %d 4095" % nid, "a %d 4095" % (nid + 1),
+                "f %d" % nid, "f %d" % (nid + 1),
+                "a %d 8190" % (nid + 2), "f %d" % (nid + 2)]
+        nid += 3
+    emit(name, ops, nid)
+
+
+def realloc(name, seed, nids=120, n=5000):
+    """Small blocks reallocated at random to up to 6000 bytes."""
+    random.seed(seed)
+    ops = []
+    for i in range(nids):
+        ops.append("a %d %d" % (i, random.randint(1, 300)))
+    for j in range(n):
+        k = random.randrange(nids)
+        ops.append("r %d %d" % (k, random.randint(1, 6000)))
+    for i in range(nids):
+        ops.append("f %d" % i)
+    emit(name, ops, nids)
+
+
+def medium(name, n, seed, maxlive=300):
+    """Random mallocs and frees of 100 bytes to 60 KB."""
+    random.seed(seed)
+    live = {}
+    ops = []
+    nid = 0
+    while len(ops) < n:
+        if len(live) > maxlive or (live and random.random() < 0.45):
+            k = random.choice(list(live))
+            ops.append("f %d" % k)
+            del live[k]
+        else:
+            s = random.randint(100, 60000)
+            ops.append("a %d %d" % (nid, s))
+            live[nid] = s
+            nid += 1
+    for k in list(live):
+        ops.append("f %d" % k)
+    emit(name, ops, nid)
+
+
+def region(name, freename, seed, reqs=60):
+    """Requests that allocate 50-150 small blocks from a region and
+    reset it, with an occasional longer-lived malloc.  freename gets
+    the same requests made with malloc and free."""
+    random.seed(seed)
+    ops = []
+    freeops = []
+    nid = 0
+    live = []
+    for r in range(reqs):
+        ids = []
+        for k in range(random.randint(50, 150)):
+            s = random.randint(1, 256)
+            ops.append("n %d %d" % (nid, s))
+            freeops.append("a %d %d" % (nid, s))
+            ids.append(nid)
+            nid += 1
+            if random.random() < 0.05:
+                ops.append("a %d 1000" % nid)
+                freeops.append("a %d 1000" % nid)
+                live.append(nid)
+                nid += 1
+        ops.append("x")
+        freeops += ["f %d" % i for i in ids]
+    for i in live:
+        ops.append("f %d" % i)
+        freeops.append("f %d" % i)
+    emit(name, ops, nid)
+    emit(freename, freeops, nid)
+
+
+rnd("synth-random-bal.rep", 4800, 1)
+rnd("synth-random2-bal.rep", 4800, 2)
+binary("synth-binary-bal.rep", 2000, 64, 448)
+binary("synth-binary2-bal.rep", 2000, 16, 112)
+coalescing("synth-coalescing-bal.rep", 2000)
+realloc("synth-realloc-bal.rep", 5)
+medium("synth-medium-bal.rep", 4000, 9)
+region("synth-region-bal.rep", "synth-region-free-bal.rep", 7)